@@ -2,21 +2,39 @@
 
 #include <fstream>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace MNIST
 {
+    namespace
+    {
+        //! The big-endian 32 bits integer at p, whatever the byte
+        //! order of the host.
+        unsigned int read_be32(const word8 *p)
+        {
+            return (unsigned int)p[0] << 24 | (unsigned int)p[1] << 16
+                | (unsigned int)p[2] << 8 | (unsigned int)p[3];
+        }
+
+        unsigned int read_be32(std::istream &is)
+        {
+            word8 bytes[4] = {0, 0, 0, 0};
+            is.read(reinterpret_cast<char*>(bytes), 4);
+            return read_be32(bytes);
+        }
+    }
 
     void ImageSet::load(std::string filename)
     {
         std::ifstream ifs(filename, std::ios::binary);
 
-        ifs.read(reinterpret_cast<char*>(&magic), 4);
-        ifs.read(reinterpret_cast<char*>(&count), 4);
-        ifs.read(reinterpret_cast<char*>(&h), 4);
-        ifs.read(reinterpret_cast<char*>(&w), 4);
-        magic = be32toh(magic);
-        count = be32toh(count);
-        h = be32toh(h);
-        w = be32toh(w);
+        magic = read_be32(ifs);
+        count = read_be32(ifs);
+        h = read_be32(ifs);
+        w = read_be32(ifs);
 
         for (int i = 0; i < count; i++)
         {
@@ -30,12 +48,86 @@ namespace MNIST
     {
         std::ifstream ifs(filename, std::ios::binary);
 
-        ifs.read(reinterpret_cast<char*>(&magic), 4);
-        ifs.read(reinterpret_cast<char*>(&count), 4);
-        magic = be32toh(magic);
-        count = be32toh(count);
+        magic = read_be32(ifs);
+        count = read_be32(ifs);
 
         labels.resize(count);
         ifs.read(reinterpret_cast<char*>(labels.data()), count);
     }
+
+    IdxFile::IdxFile()
+        :map(nullptr), map_size(0), items(nullptr), stride(0)
+    {
+    }
+
+    IdxFile::~IdxFile()
+    {
+        close();
+    }
+
+    bool IdxFile::open(std::string filename, unsigned int dimensions)
+    {
+        close();
+
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat st;
+        if (fstat(fd, &st) || st.st_size < 4)
+        {
+            ::close(fd);
+            return false;
+        }
+        void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+            return false;
+        map = static_cast<const word8 *>(p);
+        map_size = st.st_size;
+
+        // Magic number: two zero bytes, the type (0x08 for unsigned
+        // bytes) and the number of dimensions.
+        const std::size_t header_size = 4 + 4 * std::size_t(dimensions);
+        if (map[0] != 0 || map[1] != 0 || map[2] != 0x08 || map[3] != dimensions
+            || map_size < header_size)
+        {
+            close();
+            return false;
+        }
+
+        // Each product is checked against the bytes left after the
+        // header before being done, so that it can't wrap around.
+        const std::size_t data_size = map_size - header_size;
+        std::size_t size = 1;
+        for (unsigned int d = 0; d < dimensions; d++)
+        {
+            dims.push_back(read_be32(map + 4 + 4 * d));
+            if (size && dims.back() > data_size / size)
+            {
+                close();
+                return false;
+            }
+            size *= dims.back();
+        }
+        if (map_size != header_size + size)
+        {
+            close();
+            return false;
+        }
+
+        items = map + header_size;
+        stride = dims[0] ? size / dims[0] : 0;
+        return true;
+    }
+
+    void IdxFile::close()
+    {
+        if (map)
+            munmap(const_cast<word8 *>(map), map_size);
+        map = nullptr;
+        map_size = 0;
+        items = nullptr;
+        stride = 0;
+        dims.clear();
+    }
 }
@@ -0,0 +1,1448 @@
+#include "Layer.hpp"
+#include "Network.hpp"
+#include "MixedNetwork.hpp"
+#include "QuantizedNetwork.hpp"
+#include "PrunedNetwork.hpp"
+#include "InferenceServer.hpp"
+#include "Plan.hpp"
+#include "StaticNetwork.hpp"
+#include "MNIST.hpp"
+#include "MappedNetwork.hpp"
+#include "Sampler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+
+using namespace ffnn;
+
+typedef std::chrono::steady_clock bench_clock;
+
+//! Number of calls to the global operator new, counted by the
+//! replacements below for check_allocations. The single object and
+//! array forms, sized or not, all go through the same malloc and free.
+std::atomic<unsigned long> allocation_count(0);
+
+void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+//! free, kept out of line: inlined into the replacements of operator
+//! delete, GCC would see it release the memory of a new expression.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void release(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    release(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    release(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    release(p);
+}
+
+//! Build a randomized network with the given layer sizes.
+//! When custom is true, the sigmoid is called through std::function.
+template<typename T>
+Network<T> make_network(const std::vector<unsigned int> &sizes, bool custom = false)
+{
+    Network<T> net;
+    for (unsigned int i = 1; i < sizes.size(); i++)
+    {
+        Layer<T> layer(sizes[i - 1], sizes[i], ffnn::Sigmoid());
+        if (custom)
+            layer = Layer<T>(sizes[i - 1], sizes[i],
+                             std::function<T(T)>(ffnn::sigmoid<T>),
+                             std::function<T(T)>(ffnn::sigmoid_prime<T>));
+        layer.randomize();
+        net.connect_layer(layer);
+    }
+    return net;
+}
+
+//! Run each training and inference step on a workspace once, to
+//! size its buffers, then count the heap allocations of steps
+//! more runs.
+//! \return true if there was none.
+template<typename T>
+bool check_allocations(const std::vector<unsigned int> &sizes, unsigned int batch_size,
+                       unsigned int steps)
+{
+    matrix<T> inputs(sizes.front(), batch_size), outputs(sizes.back(), batch_size);
+    outputs.clear();
+    for (unsigned int j = 0; j < batch_size; j++)
+    {
+        for (unsigned int i = 0; i < inputs.size1(); i++)
+            inputs(i, j) = T((i + j) % 256) / 255;
+        outputs(j % sizes.back(), j) = 1;
+    }
+    const vector<T> input(column(inputs, 0)), output(column(outputs, 0));
+    std::vector<unsigned int> labels(batch_size), indices;
+    for (unsigned int j = 0; j < batch_size; j++)
+        labels[j] = j % sizes.back();
+    Sampler sampler(batch_size);
+    sampler.stratify(labels.begin());
+    unsigned int epoch = 0;
+
+    auto net = make_network<T>(sizes);
+    Adam<T> adam;
+    CheckpointPlan plan;
+    plan_checkpoints(net.get_layers(), batch_size, 0, plan);
+    Workspace<T> ws, batch_ws, checkpoint_ws;
+    Evaluation evaluation(sizes.back());
+    auto step = [&]() {
+        net.eval(ws, input);
+        net.train(ws, T(0.01), input, output);
+        net.train(ws, adam, input, output);
+        net.train_batch(batch_ws, T(0.01), inputs, outputs);
+        net.train_batch(batch_ws, adam, inputs, outputs);
+        net.evaluate(batch_ws, inputs, outputs, evaluation);
+        net.train_batch(checkpoint_ws, plan, T(0.01), inputs, outputs);
+        sampler.sample(epoch++, indices);
+    };
+    step();
+    const unsigned long before = allocation_count.load();
+    for (unsigned int i = 0; i < steps; i++)
+        step();
+    const unsigned long count = allocation_count.load() - before;
+
+    std::cout << "allocations";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " " << sizeof(T) * 8 << " bits : " << count << " in " << steps << " steps"
+              << (count ? " FAILED" : "") << std::endl;
+    return count == 0;
+}
+
+//! Maximum absolute and relative errors of a sigmoid kernel
+//! against the scalar ffnn::sigmoid.
+struct SigmoidError
+{
+    double absolute;
+    double relative;
+    //! Values written out of the range given to the kernel.
+    unsigned int overruns;
+};
+
+//! Run kernel(z, n) on z and on chunks of every length from 1 to
+//! 17, which covers all the remainders of the 4 and 8 wide loops,
+//! and compare with the scalar sigmoid. The relative error is only
+//! measured where the result is a normal number: below, the kernels
+//! clamp their input.
+template<typename T, typename K>
+SigmoidError sigmoid_error(const std::vector<T> &z, K kernel)
+{
+    SigmoidError error = {0, 0, 0};
+    const T guard = T(-7);
+    std::vector<T> out(z.size() + 1);
+    for (unsigned int length = 0; length <= 17; length++)
+    {
+        const std::size_t chunk = length ? length : z.size();
+        for (std::size_t start = 0; start < z.size(); start += chunk)
+        {
+            const std::size_t n = std::min(chunk, z.size() - start);
+            std::copy(z.begin() + start, z.begin() + start + n, out.begin());
+            out[n] = guard;
+            kernel(out.data(), n);
+            error.overruns += out[n] != guard;
+            for (std::size_t i = 0; i < n; i++)
+            {
+                const double expected = ffnn::sigmoid(z[start + i]);
+                const double e = std::abs(out[i] - expected);
+                error.absolute = std::max(error.absolute, e);
+                if (expected >= std::numeric_limits<T>::min())
+                    error.relative = std::max(error.relative, e / expected);
+            }
+            if (!length)
+                break;
+        }
+    }
+    return error;
+}
+
+//! Check the vectorized sigmoid kernels against the scalar
+//! sigmoid<T> over [-100, 100] by steps of 1/1024, which includes the
+//! saturated tails, and a few extreme values.
+//! \return true if every kernel is within a few ulp.
+template<typename T>
+bool check_sigmoid()
+{
+    std::vector<T> z;
+    for (int i = -100 * 1024; i <= 100 * 1024; i++)
+        z.push_back(T(i) / 1024);
+    const T extremes[] = {std::numeric_limits<T>::max(), -std::numeric_limits<T>::max(),
+                          T(1e4), T(-1e4), T(700), T(-700), std::numeric_limits<T>::min(), T(0)};
+    z.insert(z.end(), std::begin(extremes), std::end(extremes));
+
+    // Relative error allowed: a few ulp.
+    const double tolerance = 8 * std::numeric_limits<T>::epsilon();
+    std::vector<std::pair<const char *, SigmoidError>> errors;
+    errors.push_back(std::make_pair("simd", sigmoid_error(z, [](T *v, std::size_t n) {
+                    simd::sigmoid(v, n);
+                })));
+    errors.push_back(std::make_pair("bias", sigmoid_error(z, [](T *v, std::size_t n) {
+                    // A single row, with a null bias broadcasted over it.
+                    const T bias = 0;
+                    simd::bias_sigmoid(v, &bias, 1, n);
+                })));
+#ifdef FFNN_SIMD_X86
+    errors.push_back(std::make_pair("sse2", sigmoid_error(z, [](T *v, std::size_t n) {
+                    simd::detail::bias_sigmoid_sse2(v, T(0), n);
+                })));
+    if (simd::detail::has_avx2())
+        errors.push_back(std::make_pair("avx2", sigmoid_error(z, [](T *v, std::size_t n) {
+                        simd::detail::bias_sigmoid_avx2(v, T(0), n);
+                    })));
+#endif
+
+    bool ok = true;
+    std::cout << "sigmoid accuracy " << sizeof(T) * 8 << " bits :";
+    for (unsigned int k = 0; k < errors.size(); k++)
+    {
+        const SigmoidError &e = errors[k].second;
+        const bool good = e.relative <= tolerance && e.overruns == 0;
+        ok &= good;
+        std::cout << (k ? ", " : " ") << errors[k].first << " absolute " << e.absolute
+                  << " relative " << e.relative << (good ? "" : " FAILED");
+    }
+    std::cout << std::endl;
+    return ok;
+}
+
+//! Save a model with save_binary, then corrupt its layer table in
+//! ways whose offsets or sizes wrap around 64 bits, and check that
+//! MappedNetwork and Network::load_binary reject each of them.
+//! \return true if the model loads and every crafted file is rejected.
+template<typename T>
+bool check_binary()
+{
+    const char *filename = "benchmark_crafted.bin";
+    make_network<T>({64, 16}).save_binary(filename);
+    std::string model;
+    {
+        std::ifstream ifs(filename, std::ios::binary);
+        model.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    auto loads = [&](const std::string &bytes) {
+        std::ofstream(filename, std::ios::binary).write(bytes.data(), bytes.size());
+        Network<T> net;
+        MappedNetwork<T> mapped;
+        const bool by_copy = net.load_binary(filename);
+        const bool by_mapping = mapped.open(filename);
+        return by_copy || by_mapping;
+    };
+    auto crafted = [&](std::uint32_t input_size, std::uint32_t output_size,
+                       std::uint64_t weights_offset, std::uint64_t biases_offset) {
+        std::string bytes = model;
+        binary::LayerEntry e;
+        char *at = &bytes[sizeof(binary::Header)];
+        std::memcpy(&e, at, sizeof(e));
+        e.input_size = input_size ? input_size : e.input_size;
+        e.output_size = output_size ? output_size : e.output_size;
+        e.weights_offset = weights_offset ? weights_offset : e.weights_offset;
+        e.biases_offset = biases_offset ? biases_offset : e.biases_offset;
+        std::memcpy(at, &e, sizeof(e));
+        return bytes;
+    };
+
+    // The blobs of the model are larger than blob_alignment, so an
+    // offset of 2^64 - blob_alignment wraps past the end. 2^31 * 2^31
+    // weights of T wrap to 0 bytes, and their 2^31 biases end at 0
+    // when they start at 2^64 - 2^31 sizeof(T).
+    const std::uint64_t wrap = -std::uint64_t(binary::blob_alignment);
+    const std::uint32_t half = 0x80000000u;
+    const std::pair<const char *, std::string> cases[] = {
+        std::make_pair("weights offset", crafted(0, 0, wrap, 0)),
+        std::make_pair("biases offset", crafted(0, 0, 0, wrap)),
+        std::make_pair("weights size", crafted(half, half, 0, -std::uint64_t(half) * sizeof(T))),
+    };
+    bool ok = loads(model);
+    std::cout << "binary crafted " << sizeof(T) * 8 << " bits : valid model "
+              << (ok ? "loaded" : "FAILED");
+    for (const auto &c : cases)
+    {
+        const bool rejected = !loads(c.second);
+        ok &= rejected;
+        std::cout << ", " << c.first << (rejected ? " rejected" : " FAILED");
+    }
+    std::cout << std::endl;
+    std::remove(filename);
+    return ok;
+}
+
+//! Check that a network with a custom activation, which load_file
+//! couldn't read back, isn't saved as JSON, and that a sigmoid one
+//! saved by save_file loads with the same weights.
+//! \return true if both hold.
+template<typename T>
+bool check_save_file()
+{
+    const char *filename = "benchmark_custom.json";
+    std::remove(filename);
+    const bool custom_refused = !make_network<T>({16, 4}, true).save_file(filename)
+        && !std::ifstream(filename);
+    const auto net = make_network<T>({16, 4});
+    Network<T> loaded;
+    const bool reloaded = net.save_file(filename) && loaded.load_file(filename)
+        && loaded.get_layers().size() == 1
+        && norm_inf(loaded.get_layers()[0].get_weights() - net.get_layers()[0].get_weights()) == 0;
+    std::remove(filename);
+    std::cout << "save_file " << sizeof(T) * 8 << " bits : custom "
+              << (custom_refused ? "refused" : "FAILED")
+              << ", sigmoid " << (reloaded ? "reloaded" : "FAILED") << std::endl;
+    return custom_refused && reloaded;
+}
+
+//! Write a label file with a label out of the 10 classes, and check
+//! that it is mapped with the right count, and that labels_below and
+//! labels_to_batch report the bad label without writing it.
+//! \return true if the bad label is caught.
+bool check_labels()
+{
+    const char *filename = "benchmark_crafted.idx";
+    const unsigned char bytes[] = {0, 0, 8, 1, 0, 0, 0, 3, 0, 3, 12};
+    std::ofstream(filename, std::ios::binary).write(reinterpret_cast<const char *>(bytes),
+                                                    sizeof(bytes));
+    MNIST::MappedLabelSet set;
+    bool ok = set.load(filename) && set.count() == 3;
+    std::cout << "labels crafted : " << (ok ? "loaded" : "FAILED");
+    if (ok)
+    {
+        const unsigned int indices[] = {2, 1, 0};
+        matrix<float> batch(10, 3);
+        const bool below = MNIST::labels_below(set, 10);
+        const bool by_range = MNIST::labels_to_batch(set, 0u, batch);
+        const bool by_index = MNIST::labels_to_batch(set, indices, batch);
+        const bool written = batch(0, 2) == 1 && batch(3, 1) == 1 && sum(column(batch, 0)) == 0;
+        ok = !below && !by_range && !by_index && written;
+        std::cout << ", out of range label " << (ok ? "rejected" : "FAILED");
+    }
+    std::cout << std::endl;
+    set.close();
+    std::remove(filename);
+    return ok;
+}
+
+//! Write an image file whose dimensions, 2^31 x 2^31 x 4, multiply
+//! to a multiple of 2^64 bytes, which wraps around to the 0 bytes
+//! it has, and check that it is rejected.
+//! \return true if it is.
+bool check_images()
+{
+    const char *filename = "benchmark_crafted.idx";
+    const unsigned char bytes[] = {0, 0, 8, 3, 0x80, 0, 0, 0, 0x80, 0, 0, 0, 0, 0, 0, 4};
+    std::ofstream(filename, std::ios::binary).write(reinterpret_cast<const char *>(bytes),
+                                                    sizeof(bytes));
+    MNIST::MappedImageSet set;
+    const bool ok = !set.load(filename);
+    std::cout << "images crafted : wrapping size " << (ok ? "rejected" : "FAILED") << std::endl;
+    set.close();
+    std::remove(filename);
+    return ok;
+}
+
+//! Evaluate the network copying each layer, the way
+//! Network::eval used to do it.
+template<typename T>
+vector<T> eval_by_copy(const Network<T> &net, const vector<T> &input)
+{
+    vector<T> output(input);
+    for (auto layer : net.get_layers())
+        output = output >> layer;
+    return output;
+}
+
+//! Call f n times and return the number of calls per second.
+template<typename F>
+double throughput(unsigned int n, F f)
+{
+    auto start = bench_clock::now();
+    for (unsigned int i = 0; i < n; i++)
+        f();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    return n / elapsed.count();
+}
+
+template<typename T>
+void bench_eval(const std::vector<unsigned int> &sizes, unsigned int n)
+{
+    auto net = make_network<T>(sizes);
+    vector<T> input(sizes.front());
+    for (unsigned int i = 0; i < input.size(); i++)
+        input[i] = T(i % 256) / 255;
+
+    Workspace<T> ws;
+    T sink = 0;
+    double by_copy = throughput(n, [&]() {sink += eval_by_copy(net, input)[0];});
+    double by_ref = throughput(n, [&]() {sink += net.eval(input)[0];});
+    double with_ws = throughput(n, [&]() {sink += net.eval(ws, input)[0];});
+
+    std::cout << "eval";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " : copy " << by_copy << "/s"
+              << ", reference " << by_ref << "/s"
+              << ", workspace " << with_ws << "/s"
+              << (sink == 42 ? " " : "") << std::endl;
+}
+
+template<typename T>
+void bench_activation(const std::vector<unsigned int> &sizes, unsigned int n)
+{
+    auto custom = make_network<T>(sizes, true);
+    auto policy = make_network<T>(sizes);
+    vector<T> input(sizes.front());
+    for (unsigned int i = 0; i < input.size(); i++)
+        input[i] = T(i % 256) / 255;
+    vector<T> output(sizes.back(), T(0));
+
+    Workspace<T> ws;
+    double by_function = throughput(n, [&]() {custom.train(ws, T(0.1), input, output);});
+    double by_policy = throughput(n, [&]() {policy.train(ws, T(0.1), input, output);});
+
+    std::cout << "train";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " : std::function " << by_function << "/s"
+              << ", policy " << by_policy << "/s" << std::endl;
+}
+
+template<typename T>
+void bench_sigmoid(unsigned int size, unsigned int n)
+{
+    std::vector<T> z(size);
+    for (unsigned int i = 0; i < size; i++)
+        z[i] = T(int(i % 200) - 100) / 10;
+
+    double scalar = throughput(n, [&]() {
+            for (auto &v : z)
+                v = ffnn::sigmoid(v);
+        });
+    double vectorized = throughput(n, [&]() {simd::sigmoid(z.data(), z.size());});
+
+    std::cout << "sigmoid " << sizeof(T) * 8 << " bits x" << size
+              << " : scalar " << scalar * size << " values/s"
+              << ", simd " << vectorized * size << " values/s" << std::endl;
+}
+
+//! Data-parallel train_batch from 1 thread to the number of cores.
+template<typename T>
+void bench_parallel(const std::vector<unsigned int> &sizes, unsigned int batch_size,
+                    unsigned int n)
+{
+    matrix<T> inputs(sizes.front(), batch_size);
+    matrix<T> outputs(sizes.back(), batch_size);
+    for (unsigned int j = 0; j < batch_size; j++)
+    {
+        for (unsigned int i = 0; i < inputs.size1(); i++)
+            inputs(i, j) = T((i + j) % 256) / 255;
+        for (unsigned int i = 0; i < outputs.size1(); i++)
+            outputs(i, j) = i == j % outputs.size1();
+    }
+
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= cores; threads *= 2)
+    {
+        auto net = make_network<T>(sizes);
+        ThreadPool pool(threads);
+        std::vector<Workspace<T>> workspaces;
+        double batches = throughput(n, [&]() {
+                net.train_batch(pool, workspaces, T(0.1), inputs, outputs);
+            });
+
+        std::cout << "train_batch";
+        for (auto s : sizes)
+            std::cout << " " << s;
+        std::cout << " batch " << batch_size << " threads " << threads
+                  << " : " << batches * batch_size << " samples/s" << std::endl;
+    }
+}
+
+//! Time of one call to f, in seconds.
+template<typename F>
+double duration(F f)
+{
+    auto start = bench_clock::now();
+    f();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+    return elapsed.count();
+}
+
+template<typename T>
+void bench_model_io(const std::vector<unsigned int> &sizes)
+{
+    namespace pt = boost::property_tree;
+
+    auto net = make_network<T>(sizes);
+    Network<T> loaded;
+    MappedNetwork<T> mapped;
+
+    double save_ptree = duration([&]() {
+            std::ofstream ofs("benchmark_model.json");
+            pt::write_json(ofs, net.serialize());
+        });
+    double load_ptree = duration([&]() {
+            pt::ptree tree;
+            std::ifstream ifs("benchmark_model.json");
+            pt::read_json(ifs, tree);
+            loaded.load(tree);
+        });
+    double save_stream = duration([&]() {net.save_file("benchmark_model.json");});
+    double load_stream = duration([&]() {loaded.load_file("benchmark_model.json");});
+    double save_binary = duration([&]() {net.save_binary("benchmark_model.bin");});
+    double load_binary = duration([&]() {loaded.load_binary("benchmark_model.bin");});
+    double map_binary = duration([&]() {mapped.open("benchmark_model.bin");});
+
+    std::cout << "model";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " : ptree save " << save_ptree << "s load " << load_ptree << "s"
+              << ", stream save " << save_stream << "s load " << load_stream << "s"
+              << ", binary save " << save_binary << "s load " << load_binary << "s"
+              << " mmap " << map_binary << "s" << std::endl;
+}
+
+//! Batched training and evaluation with double, float, and the
+//! mixed precision float/half and float/bfloat16.
+void bench_precision(const std::vector<unsigned int> &sizes, unsigned int batch_size,
+                     unsigned int n)
+{
+    matrix<float> inputs(sizes.front(), batch_size);
+    matrix<float> outputs(sizes.back(), batch_size);
+    for (unsigned int j = 0; j < batch_size; j++)
+    {
+        for (unsigned int i = 0; i < inputs.size1(); i++)
+            inputs(i, j) = float((i + j) % 256) / 255;
+        for (unsigned int i = 0; i < outputs.size1(); i++)
+            outputs(i, j) = i == j % outputs.size1();
+    }
+    const matrix<double> inputs_d(inputs), outputs_d(outputs);
+
+    auto report = [&](const char *type, double eval, double train) {
+        std::cout << "precision";
+        for (auto s : sizes)
+            std::cout << " " << s;
+        std::cout << " batch " << batch_size << " " << type
+                  << " : eval " << eval * batch_size << " samples/s"
+                  << ", train " << train * batch_size << " samples/s" << std::endl;
+    };
+
+    {
+        auto net = make_network<double>(sizes);
+        Workspace<double> ws;
+        report("double",
+               throughput(n, [&]() {net.forward_batch(ws, inputs_d);}),
+               throughput(n, [&]() {net.train_batch(ws, 0.1, inputs_d, outputs_d);}));
+    }
+    {
+        auto net = make_network<float>(sizes);
+        Workspace<float> ws;
+        report("float",
+               throughput(n, [&]() {net.forward_batch(ws, inputs);}),
+               throughput(n, [&]() {net.train_batch(ws, 0.1f, inputs, outputs);}));
+    }
+    {
+        MixedNetwork<half> net(make_network<float>(sizes));
+        Workspace<float> ws;
+        report("half",
+               throughput(n, [&]() {net.forward_batch(ws, inputs);}),
+               throughput(n, [&]() {net.train_batch(ws, 0.1f, inputs, outputs);}));
+    }
+    {
+        MixedNetwork<bfloat16> net(make_network<float>(sizes));
+        Workspace<float> ws;
+        report("bfloat16",
+               throughput(n, [&]() {net.forward_batch(ws, inputs);}),
+               throughput(n, [&]() {net.train_batch(ws, 0.1f, inputs, outputs);}));
+    }
+}
+
+//! Per-sample evaluation with T against the int8 quantized version.
+template<typename T>
+void bench_quantized(const std::vector<unsigned int> &sizes, unsigned int n)
+{
+    auto net = make_network<T>(sizes);
+    matrix<T> calibration(sizes.front(), 64);
+    for (unsigned int i = 0; i < calibration.size1(); i++)
+        for (unsigned int j = 0; j < calibration.size2(); j++)
+            calibration(i, j) = T((i * 7 + j) % 256) / 255;
+    QuantizedNetwork<T> quantized(net, calibration);
+
+    vector<T> input(column(calibration, 0));
+    Workspace<T> ws;
+    typename QuantizedNetwork<T>::Scratch scratch;
+    T sink = 0;
+    double reference = throughput(n, [&]() {sink += net.eval(ws, input)[0];});
+    double int8 = throughput(n, [&]() {sink += quantized.eval(scratch, input)[0];});
+
+    std::cout << "quantized";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " : " << sizeof(T) * 8 << " bits " << reference << "/s"
+              << ", int8 " << int8 << "/s"
+              << (sink == 42 ? " " : "") << std::endl;
+}
+
+//! Largest difference between a and b, relative to the largest
+//! absolute value of b.
+template<class E1, class E2>
+double max_error(const E1 &a, const E2 &b)
+{
+    double diff = 0, scale = 0;
+    for (unsigned int i = 0; i < a.size1(); i++)
+        for (unsigned int j = 0; j < a.size2(); j++)
+        {
+            diff = std::max(diff, double(std::abs(a(i, j) - b(i, j))));
+            scale = std::max(scale, double(std::abs(b(i, j))));
+        }
+    return scale > 0 ? diff / scale : diff;
+}
+
+template<typename T>
+double max_error(const vector<T> &a, const vector<T> &b)
+{
+    return max_error(matrix<T>(outer_prod(a, scalar_vector<T>(1, 1))),
+                     matrix<T>(outer_prod(b, scalar_vector<T>(1, 1))));
+}
+
+//! The products of Gemm.hpp against the uBLAS ones, for a size x size
+//! layer: forward and backward for one sample (gemv and gemv_trans),
+//! and for a batch (multiply by the inputs, by the deltas with the
+//! weights transposed, and of the deltas by the transposed inputs).
+//! Reports the speed in GFLOP/s, and the error compared to uBLAS.
+template<typename T>
+void bench_gemm(unsigned int size, unsigned int batch_size)
+{
+    matrix<T> w(size, size), x(size, batch_size);
+    for (unsigned int i = 0; i < size; i++)
+    {
+        for (unsigned int j = 0; j < size; j++)
+            w(i, j) = T(int((i * 31 + j * 17) % 201) - 100) / 100;
+        for (unsigned int j = 0; j < batch_size; j++)
+            x(i, j) = T(int((i * 7 + j * 13) % 101) - 50) / 50;
+    }
+    const vector<T> v(column(x, 0));
+    vector<T> y(size), y_ref(size);
+    matrix<T> c(size, batch_size), c_ref(size, batch_size), g(size, size), g_ref(size, size);
+
+    // Enough calls for about 2^28 multiply-adds of each kind.
+    const unsigned int n_gemv = std::max(1u, (1u << 28) / (size * size));
+    const unsigned int n_gemm = std::max(1u, n_gemv / batch_size);
+    const double gemv_flop = 2.0 * size * size;
+    const double gemm_flop = gemv_flop * batch_size;
+
+    auto report = [&](const char *name, double flop, double ublas, double ours, double error) {
+        std::cout << "gemm " << sizeof(T) * 8 << " bits " << name << " " << size
+                  << " : ublas " << flop * ublas * 1e-9 << " GFLOP/s"
+                  << ", gemm " << flop * ours * 1e-9 << " GFLOP/s"
+                  << ", error " << error << std::endl;
+    };
+
+    double ublas = throughput(n_gemv, [&]() {noalias(y_ref) = prod(w, v);});
+    double ours = throughput(n_gemv, [&]() {
+            gemm::gemv(size, size, &w.data()[0], &v.data()[0], &y.data()[0]);
+        });
+    report("gemv", gemv_flop, ublas, ours, max_error(y, y_ref));
+
+    ublas = throughput(n_gemv, [&]() {noalias(y_ref) = prod(trans(w), v);});
+    ours = throughput(n_gemv, [&]() {
+            gemm::gemv_trans(size, size, &w.data()[0], &v.data()[0], &y.data()[0]);
+        });
+    report("gemv_trans", gemv_flop, ublas, ours, max_error(y, y_ref));
+
+    ublas = throughput(n_gemm, [&]() {noalias(c_ref) = prod(w, x);});
+    ours = throughput(n_gemm, [&]() {
+            gemm::multiply(size, batch_size, size, gemm::row_major(&w.data()[0], size),
+                           gemm::row_major(&x.data()[0], batch_size), &c.data()[0], batch_size);
+        });
+    report("forward", gemm_flop, ublas, ours, max_error(c, c_ref));
+
+    ublas = throughput(n_gemm, [&]() {noalias(c_ref) = prod(trans(w), x);});
+    ours = throughput(n_gemm, [&]() {
+            gemm::multiply(size, batch_size, size, gemm::row_major(&w.data()[0], size).trans(),
+                           gemm::row_major(&x.data()[0], batch_size), &c.data()[0], batch_size);
+        });
+    report("backward", gemm_flop, ublas, ours, max_error(c, c_ref));
+
+    ublas = throughput(n_gemm, [&]() {noalias(g_ref) = prod(x, trans(x));});
+    ours = throughput(n_gemm, [&]() {
+            gemm::multiply(size, size, batch_size, gemm::row_major(&x.data()[0], batch_size),
+                           gemm::row_major(&x.data()[0], batch_size).trans(), &g.data()[0], size);
+        });
+    report("gradient", gemm_flop, ublas, ours, max_error(g, g_ref));
+}
+
+//! Training on inputs with the given fraction of nonzeros, stored
+//! dense and sparse, sample by sample and by batches. Then the
+//! evaluation of the network pruned to the same density.
+template<typename T>
+void bench_sparse(const std::vector<unsigned int> &sizes, double density,
+                  unsigned int batch_size, unsigned int n)
+{
+    const unsigned int step = std::max(1u, unsigned(1 / density));
+    matrix<T> inputs(sizes.front(), batch_size, 0), outputs(sizes.back(), batch_size, 0);
+    compressed_matrix<T, column_major> sparse_inputs(sizes.front(), batch_size);
+    for (unsigned int j = 0; j < batch_size; j++)
+    {
+        for (unsigned int i = j % step; i < inputs.size1(); i += step)
+            sparse_inputs(i, j) = inputs(i, j) = T(1 + i % 7) / 7;
+        outputs(j % outputs.size1(), j) = 1;
+    }
+    const compressed_vector<T> sparse_input(column(sparse_inputs, 0));
+    const vector<T> input(column(inputs, 0)), output(column(outputs, 0));
+
+    auto net = make_network<T>(sizes);
+    Workspace<T> ws;
+    T sink = 0;
+    double dense_eval = throughput(n, [&]() {sink += net.eval(ws, input)[0];});
+    double sparse_eval = throughput(n, [&]() {sink += net.eval(ws, sparse_input)[0];});
+    double dense_train = throughput(n, [&]() {net.train(ws, 0.1, input, output);});
+    double sparse_train = throughput(n, [&]() {net.train(ws, 0.1, sparse_input, output);});
+    const unsigned int batches = std::max(1u, n / batch_size);
+    double dense_batch = throughput(batches, [&]() {net.train_batch(ws, 0.1, inputs, outputs);});
+    double sparse_batch = throughput(batches, [&]() {net.train_batch(ws, 0.1, sparse_inputs, outputs);});
+
+    std::cout << "sparse";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " density " << density
+              << " : eval dense " << dense_eval << "/s, sparse " << sparse_eval << "/s"
+              << ", train dense " << dense_train << "/s, sparse " << sparse_train << "/s"
+              << ", batch " << batch_size << " dense " << dense_batch * batch_size
+              << " samples/s, sparse " << sparse_batch * batch_size << " samples/s"
+              << (sink == 42 ? " " : "") << std::endl;
+}
+
+//! Per-sample evaluation with T against the version of the
+//! network keeping the given fraction of its weights.
+template<typename T>
+void bench_pruned(const std::vector<unsigned int> &sizes, double density, unsigned int n)
+{
+    auto net = make_network<T>(sizes);
+    PrunedNetwork<T> pruned(net, density);
+    vector<T> input(sizes.front());
+    for (unsigned int i = 0; i < input.size(); i++)
+        input[i] = T(i % 256) / 255;
+
+    Workspace<T> ws;
+    typename PrunedNetwork<T>::Scratch scratch;
+    T sink = 0;
+    double reference = throughput(n, [&]() {sink += net.eval(ws, input)[0];});
+    double sparse = throughput(n, [&]() {sink += pruned.eval(scratch, input)[0];});
+
+    std::cout << "pruned";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " density " << pruned.density() << " : dense " << reference << "/s"
+              << ", pruned " << sparse << "/s, " << pruned.storage_size() << " bytes"
+              << (sink == 42 ? " " : "") << std::endl;
+}
+
+//! Load generator for InferenceServer: client threads each
+//! submitting n inputs one after the other, waiting for each result.
+//! max_batch 1 is the uncoalesced reference.
+template<typename T>
+void bench_server(const std::vector<unsigned int> &sizes, unsigned int clients,
+                  unsigned int workers, unsigned int max_batch,
+                  std::chrono::microseconds max_delay, unsigned int n)
+{
+    auto net = make_network<T>(sizes);
+    InferenceServer<T> server(net, workers, max_batch, max_delay);
+    std::vector<std::thread> threads;
+    for (unsigned int c = 0; c < clients; c++)
+        threads.push_back(std::thread([&, c]() {
+                    vector<T> input(sizes.front());
+                    for (unsigned int r = 0; r < n; r++)
+                    {
+                        for (unsigned int i = 0; i < input.size(); i++)
+                            input[i] = T((i + c + r) % 256) / 255;
+                        server.eval(input);
+                    }
+                }));
+    for (auto &t : threads)
+        t.join();
+
+    const typename InferenceServer<T>::Stats stats = server.stats();
+    std::cout << "server";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " clients " << clients << " workers " << workers
+              << " batch " << max_batch << " delay " << max_delay.count() << " us"
+              << " : " << stats.throughput << "/s, mean batch " << stats.mean_batch
+              << ", p50 " << stats.p50 << " us, p99 " << stats.p99 << " us" << std::endl;
+}
+
+//! Per-sample evaluation with Network::eval against the compiled Plan.
+template<typename T>
+void bench_plan(const std::vector<unsigned int> &sizes, unsigned int n)
+{
+    auto net = make_network<T>(sizes);
+    const Plan<T> plan = compile(net);
+    vector<T> input(sizes.front());
+    for (unsigned int i = 0; i < input.size(); i++)
+        input[i] = T(i % 256) / 255;
+
+    Workspace<T> ws;
+    typename Plan<T>::Scratch scratch;
+    T sink = 0;
+    double reference = throughput(n, [&]() {sink += net.eval(ws, input)[0];});
+    double planned = throughput(n, [&]() {sink += plan(scratch, input)[0];});
+
+    std::cout << "plan";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " " << sizeof(T) * 8 << " bits : eval " << 1e6 / reference << " us"
+              << ", plan " << 1e6 / planned << " us, error "
+              << max_error(plan(scratch, input), net.eval(ws, input))
+              << (sink == 42 ? " " : "") << std::endl;
+}
+
+//! Per-sample evaluation and training of Network against the
+//! StaticNetwork of the same topology.
+template<typename T, unsigned int... Sizes>
+void bench_static(unsigned int n)
+{
+    const std::vector<unsigned int> sizes = {Sizes...};
+    auto net = make_network<T>(sizes);
+    StaticNetwork<T, Sizes...> fixed(net);
+    const Plan<T> plan = compile(net);
+    vector<T> input(sizes.front()), target(sizes.back(), T(0));
+    for (unsigned int i = 0; i < input.size(); i++)
+        input[i] = T(i % 256) / 255;
+    target[0] = 1;
+
+    Workspace<T> ws;
+    typename Plan<T>::Scratch scratch;
+    vector<T> output(sizes.back());
+    T sink = 0;
+    const double error = max_error(fixed.eval(input), net.eval(ws, input));
+    double reference = throughput(n, [&]() {sink += net.eval(ws, input)[0];});
+    double planned = throughput(n, [&]() {sink += plan(scratch, input)[0];});
+    double evaluated = throughput(n, [&]() {
+            fixed.eval(&input[0], &output[0]);
+            sink += output[0];
+        });
+    double trained = throughput(n, [&]() {net.train(ws, T(0.01), input, target);});
+    double trained_fixed = throughput(n, [&]() {fixed.train(T(0.01), input, target);});
+
+    std::cout << "static";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " " << sizeof(T) * 8 << " bits : eval " << 1e6 / reference << " us"
+              << ", plan " << 1e6 / planned << " us, static " << 1e6 / evaluated << " us"
+              << ", train " << 1e6 / trained << " us, static " << 1e6 / trained_fixed
+              << " us, error " << error << (sink == 42 ? " " : "") << std::endl;
+}
+
+//! Evaluation of a whole set: one eval and argmax per sample, as the
+//! examples used to do, against Network::evaluate by batches, on one
+//! thread and on all the cores.
+template<typename T>
+void bench_evaluate(const std::vector<unsigned int> &sizes, unsigned int samples)
+{
+    auto net = make_network<T>(sizes);
+    matrix<T> inputs(sizes.front(), samples), outputs(sizes.back(), samples);
+    outputs.clear();
+    for (unsigned int j = 0; j < samples; j++)
+    {
+        for (unsigned int i = 0; i < inputs.size1(); i++)
+            inputs(i, j) = T((i * 7 + j * 3) % 256) / 255;
+        outputs(j % sizes.back(), j) = 1;
+    }
+
+    auto argmax = [](const vector<T> &v) {
+        unsigned int k = 0;
+        for (unsigned int i = 1; i < v.size(); i++)
+            if (v[i] > v[k])
+                k = i;
+        return k;
+    };
+    unsigned int correct = 0;
+    double by_sample = duration([&]() {
+            for (unsigned int j = 0; j < samples; j++)
+                correct += argmax(net.eval(vector<T>(column(inputs, j))))
+                    == argmax(vector<T>(column(outputs, j)));
+        });
+    Workspace<T> ws;
+    Evaluation serial;
+    double batched = duration([&]() {net.evaluate(ws, inputs, outputs, serial);});
+    ThreadPool pool;
+    std::vector<Workspace<T>> workspaces;
+    Evaluation parallel;
+    double threaded = duration([&]() {net.evaluate(pool, workspaces, inputs, outputs, parallel);});
+
+    std::cout << "evaluate";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " x" << samples << " : per sample " << samples / by_sample << "/s"
+              << ", batch " << samples / batched << "/s"
+              << ", threads " << pool.size() << " " << samples / threaded << "/s"
+              << (correct == serial.correct && correct == parallel.correct ? "" : ", MISMATCH")
+              << std::endl;
+}
+
+//! Training steps with a learning rate against the optimizers, per
+//! sample and by batches.
+template<typename T>
+void bench_optimizer(const std::vector<unsigned int> &sizes, unsigned int batch_size,
+                     unsigned int n)
+{
+    vector<T> input(sizes.front()), output(sizes.back(), T(0));
+    matrix<T> inputs(sizes.front(), batch_size), outputs(sizes.back(), batch_size);
+    outputs.clear();
+    for (unsigned int j = 0; j < batch_size; j++)
+    {
+        for (unsigned int i = 0; i < inputs.size1(); i++)
+            inputs(i, j) = T((i + j) % 256) / 255;
+        outputs(j % sizes.back(), j) = 1;
+    }
+    noalias(input) = column(inputs, 0);
+    noalias(output) = column(outputs, 0);
+
+    Sgd<T> sgd(T(0.01));
+    Momentum<T> momentum(T(0.01));
+    Adam<T> adam;
+    Optimizer<T> *optimizers[] = {&sgd, &momentum, &adam};
+    const char *names[] = {"sgd", "momentum", "adam"};
+
+    Workspace<T> ws;
+    auto net = make_network<T>(sizes);
+    std::cout << "optimizer";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " " << sizeof(T) * 8 << " bits : train rate "
+              << 1e6 / throughput(n, [&]() {net.train(ws, T(0.01), input, output);}) << " us";
+    for (unsigned int k = 0; k < 3; k++)
+        std::cout << ", " << names[k] << " " << 1e6 / throughput(n, [&]() {
+                net.train(ws, *optimizers[k], input, output);
+            }) << " us";
+    std::cout << ", batch " << batch_size << " rate "
+              << 1e6 / throughput(n / batch_size, [&]() {
+                      net.train_batch(ws, T(0.01), inputs, outputs);
+                  }) << " us";
+    for (unsigned int k = 0; k < 3; k++)
+        std::cout << ", " << names[k] << " " << 1e6 / throughput(n / batch_size, [&]() {
+                net.train_batch(ws, *optimizers[k], inputs, outputs);
+            }) << " us";
+    std::cout << std::endl;
+}
+
+//! Memory and time of train_batch with checkpointed activations,
+//! for budgets of a fraction of the buffers of the default path.
+template<typename T>
+void bench_checkpoint(const std::vector<unsigned int> &sizes, unsigned int batch_size,
+                      unsigned int n)
+{
+    matrix<T> inputs(sizes.front(), batch_size), outputs(sizes.back(), batch_size);
+    outputs.clear();
+    for (unsigned int j = 0; j < batch_size; j++)
+    {
+        for (unsigned int i = 0; i < inputs.size1(); i++)
+            inputs(i, j) = T((i + j) % 256) / 255;
+        outputs(j % sizes.back(), j) = 1;
+    }
+
+    auto net = make_network<T>(sizes);
+    const std::size_t full = batch_activation_bytes(net.get_layers(), batch_size);
+    Workspace<T> ws;
+    const double base = 1e3 / throughput(n, [&]() {net.train_batch(ws, T(0.01), inputs, outputs);});
+    std::cout << "checkpoint " << sizes.size() - 1 << " layers batch " << batch_size << " "
+              << sizeof(T) * 8 << " bits : default " << full / 1024 << " KiB " << base << " ms";
+    for (unsigned int fraction : {1, 2, 3, 4})
+    {
+        CheckpointPlan plan;
+        const bool fits = plan_checkpoints(net.get_layers(), batch_size, full / fraction, plan);
+        Workspace<T> cws;
+        const double ms = 1e3 / throughput(n, [&]() {
+                net.train_batch(cws, plan, T(0.01), inputs, outputs);
+            });
+        std::cout << ", budget 1/" << fraction << (fits ? "" : " (over)") << " "
+                  << plan.checkpoints.size() << " checkpoints " << plan.bytes / 1024 << " KiB "
+                  << ms << " ms (" << (ms / base - 1) * 100 << "%)";
+    }
+    std::cout << std::endl;
+}
+
+//! Stress of the const inference API: threads threads evaluate the
+//! same models at once, each with its own buffers, and compare the
+//! outputs with the ones computed by a single thread. Meant to also
+//! be run in a ThreadSanitizer build (-DSANITIZE_THREAD=ON).
+//! \return The number of outputs differing from the reference.
+template<typename T>
+unsigned int bench_shared(const std::vector<unsigned int> &sizes, unsigned int threads,
+                  unsigned int samples, unsigned int rounds)
+{
+    const auto net = make_network<T>(sizes);
+    matrix<T> inputs(sizes.front(), samples);
+    for (unsigned int i = 0; i < inputs.size1(); i++)
+        for (unsigned int j = 0; j < inputs.size2(); j++)
+            inputs(i, j) = T((i * 5 + j * 3) % 256) / 255;
+    net.save_binary("benchmark_shared.bin");
+    const MappedNetwork<T> mapped("benchmark_shared.bin");
+    const QuantizedNetwork<T> quantized(net, inputs);
+    const PrunedNetwork<T> pruned(net, 0.5);
+
+    // Reference outputs, one column per sample and per model, and
+    // the ones of the whole batch.
+    matrix<T> reference(sizes.back(), 4 * samples), batch_reference;
+    {
+        Workspace<T> ws;
+        net.forward_batch(ws, inputs);
+        batch_reference = ws.batch_activations.back();
+        typename MappedNetwork<T>::Scratch mapped_scratch;
+        typename QuantizedNetwork<T>::Scratch quantized_scratch;
+        typename PrunedNetwork<T>::Scratch pruned_scratch;
+        for (unsigned int j = 0; j < samples; j++)
+        {
+            const vector<T> input(column(inputs, j));
+            column(reference, j) = net.eval(ws, input);
+            column(reference, samples + j) = mapped.eval(mapped_scratch, input);
+            column(reference, 2 * samples + j) = quantized.eval(quantized_scratch, input);
+            column(reference, 3 * samples + j) = pruned.eval(pruned_scratch, input);
+        }
+    }
+
+    std::vector<unsigned int> mismatches(threads, 0);
+    std::vector<std::thread> pool;
+    auto start = bench_clock::now();
+    for (unsigned int k = 0; k < threads; k++)
+        pool.push_back(std::thread([&, k]() {
+                    Workspace<T> ws;
+                    typename MappedNetwork<T>::Scratch mapped_scratch;
+                    typename QuantizedNetwork<T>::Scratch quantized_scratch;
+                    typename PrunedNetwork<T>::Scratch pruned_scratch;
+                    vector<T> input(sizes.front());
+                    auto differs = [&](const vector<T> &output, unsigned int c) {
+                        for (unsigned int i = 0; i < output.size(); i++)
+                            if (output[i] != reference(i, c))
+                                return true;
+                        return false;
+                    };
+                    for (unsigned int r = 0; r < rounds; r++)
+                    {
+                        net.forward_batch(ws, inputs);
+                        const matrix<T> &outputs = ws.batch_activations.back();
+                        for (unsigned int j = 0; j < samples; j++)
+                            for (unsigned int i = 0; i < outputs.size1(); i++)
+                                mismatches[k] += outputs(i, j) != batch_reference(i, j);
+                        for (unsigned int j = 0; j < samples; j++)
+                        {
+                            // Each thread starts at a different sample.
+                            const unsigned int s = (j + k) % samples;
+                            noalias(input) = column(inputs, s);
+                            mismatches[k] += differs(net.eval(ws, input), s);
+                            mismatches[k] += differs(mapped.eval(mapped_scratch, input), samples + s);
+                            mismatches[k] += differs(quantized.eval(quantized_scratch, input),
+                                                     2 * samples + s);
+                            mismatches[k] += differs(pruned.eval(pruned_scratch, input),
+                                                     3 * samples + s);
+                        }
+                    }
+                }));
+    for (auto &t : pool)
+        t.join();
+    std::chrono::duration<double> elapsed = bench_clock::now() - start;
+
+    unsigned int total = 0;
+    for (auto m : mismatches)
+        total += m;
+    std::cout << "shared";
+    for (auto s : sizes)
+        std::cout << " " << s;
+    std::cout << " threads " << threads << " : "
+              << threads * rounds * samples * 4 / elapsed.count() << " evals/s, "
+              << total << " mismatches" << (total ? " FAILED" : "") << std::endl;
+    std::remove("benchmark_shared.bin");
+    return total;
+}
+
+//! One measure of the suite, identified by id, such as
+//! "network_train/float/784-256-10".
+struct SuiteResult
+{
+    std::string id;
+    std::string name;
+    std::string type;
+    std::vector<unsigned int> sizes;
+    //! Calls timed together in each repetition.
+    unsigned int calls;
+    //! Seconds per call, median and best of the repetitions.
+    double median;
+    double best;
+};
+
+template<typename T> const char *type_name();
+template<> const char *type_name<float>() {return "float";}
+template<> const char *type_name<double>() {return "double";}
+
+/**
+ * Time f over 7 repetitions, after a warm up. Each repetition
+ * calls f enough times to last about 20 ms, the same number of
+ * times for all of them, and the median of the repetitions is
+ * kept, which is what the regressions are checked against.
+ */
+template<typename F>
+SuiteResult measure(const std::string &name, const char *type,
+                    const std::vector<unsigned int> &sizes, F f)
+{
+    const unsigned int repetitions = 7;
+    SuiteResult r;
+    r.name = name;
+    r.type = type;
+    r.sizes = sizes;
+    r.id = name + "/" + type;
+    for (unsigned int i = 0; i < sizes.size(); i++)
+        r.id += (i ? "-" : "/") + std::to_string(sizes[i]);
+
+    const double once = duration(f);
+    r.calls = std::max(1u, unsigned(0.02 / std::max(once, 1e-9)));
+    std::vector<double> times;
+    for (unsigned int k = 0; k < repetitions; k++)
+        times.push_back(1 / throughput(r.calls, f));
+    std::sort(times.begin(), times.end());
+    r.median = times[repetitions / 2];
+    r.best = times[0];
+    return r;
+}
+
+//! Layer, Network and model file measures for the layer sizes and T.
+template<typename T>
+void suite_network(std::vector<SuiteResult> &results, const std::vector<unsigned int> &sizes)
+{
+    namespace pt = boost::property_tree;
+    const char *type = type_name<T>();
+    auto net = make_network<T>(sizes);
+    const Layer<T> &layer = net.get_layers().front();
+    vector<T> input(sizes.front()), output(sizes.back(), T(0));
+    for (unsigned int i = 0; i < input.size(); i++)
+        input[i] = T(i % 256) / 255;
+    output[0] = 1;
+    const std::vector<unsigned int> layer_sizes = {sizes[0], sizes[1]};
+
+    Workspace<T> ws;
+    T sink = 0;
+    results.push_back(measure("layer_forward", type, layer_sizes, [&]() {
+                sink += (layer << input)[0];
+            }));
+    results.push_back(measure("network_eval", type, sizes, [&]() {
+                sink += net.eval(input)[0];
+            }));
+    results.push_back(measure("network_eval_workspace", type, sizes, [&]() {
+                sink += net.eval(ws, input)[0];
+            }));
+    // Trains a copy, not to change the network of the other measures.
+    Network<T> trained = net;
+    results.push_back(measure("network_train", type, sizes, [&]() {
+                trained.train(ws, T(0.01), input, output);
+            }));
+
+    pt::ptree tree;
+    results.push_back(measure("layer_serialize", type, layer_sizes, [&]() {
+                tree = layer.serialize();
+            }));
+    Layer<T> loaded;
+    results.push_back(measure("layer_load", type, layer_sizes, [&]() {
+                loaded.load(tree);
+            }));
+    results.push_back(measure("network_save_file", type, sizes, [&]() {
+                net.save_file("benchmark_suite.json");
+            }));
+    Network<T> read;
+    results.push_back(measure("network_load_file", type, sizes, [&]() {
+                read.load_file("benchmark_suite.json");
+            }));
+    if (sink == 42)
+        std::cout << " ";
+}
+
+//! Write count synthetic images of 28 x 28 in the IDX format of
+//! MNIST, the same ones at each run.
+void write_images(const std::string &filename, unsigned int count)
+{
+    std::ofstream ofs(filename, std::ios::binary);
+    const unsigned char header[16] = {0, 0, 8, 3,
+                                      (unsigned char)(count >> 24), (unsigned char)(count >> 16),
+                                      (unsigned char)(count >> 8), (unsigned char)count,
+                                      0, 0, 0, 28, 0, 0, 0, 28};
+    ofs.write(reinterpret_cast<const char *>(header), sizeof(header));
+    std::minstd_rand eng(1);
+    std::vector<char> image(28 * 28);
+    for (unsigned int i = 0; i < count; i++)
+    {
+        for (auto &p : image)
+            p = char(eng() % 256);
+        ofs.write(image.data(), image.size());
+    }
+}
+
+void suite_mnist(std::vector<SuiteResult> &results)
+{
+    const unsigned int count = 10000;
+    write_images("benchmark_suite-images-idx3-ubyte", count);
+    unsigned int sink = 0;
+    results.push_back(measure("mnist_imageset_load", "uint8", {count}, [&]() {
+                MNIST::ImageSet set;
+                set.load("benchmark_suite-images-idx3-ubyte");
+                sink += set.images.size();
+            }));
+    results.push_back(measure("mnist_mapped_load", "uint8", {count}, [&]() {
+                MNIST::MappedImageSet set;
+                sink += set.load("benchmark_suite-images-idx3-ubyte");
+            }));
+    if (sink == 42)
+        std::cout << " ";
+}
+
+//! Run the suite, print it and write it as JSON to filename.
+void run_suite(const std::string &filename)
+{
+    std::vector<SuiteResult> results;
+    const std::vector<std::vector<unsigned int>> topologies = {
+        {84, 15, 10}, {784, 64, 10}, {784, 256, 10}
+    };
+    for (const auto &sizes : topologies)
+    {
+        suite_network<float>(results, sizes);
+        suite_network<double>(results, sizes);
+    }
+    suite_mnist(results);
+
+    for (const auto &r : results)
+        std::cout << r.id << " : " << r.median * 1e6 << " us (best "
+                  << r.best * 1e6 << " us)" << std::endl;
+
+    std::ofstream ofs(filename);
+    json::Writer w(ofs);
+    w.begin_object();
+    w.key("suite");
+    w.value("ffnn");
+    w.key("version");
+    w.value(1u);
+    w.key("compiler");
+    w.value(__VERSION__);
+    w.key("results");
+    w.begin_array();
+    for (const auto &r : results)
+    {
+        w.begin_object();
+        w.key("id");
+        w.value(r.id.c_str());
+        w.key("name");
+        w.value(r.name.c_str());
+        w.key("type");
+        w.value(r.type.c_str());
+        w.key("sizes");
+        w.begin_array();
+        for (auto s : r.sizes)
+            w.value(s);
+        w.end_array();
+        w.key("calls");
+        w.value(r.calls);
+        w.key("median_seconds");
+        w.value(r.median);
+        w.key("best_seconds");
+        w.value(r.best);
+        w.end_object();
+    }
+    w.end_array();
+    w.end_object();
+    ofs << "\n";
+    std::cout << "Results written to " << filename << std::endl;
+}
+
+//! Read the median time of each id of a file written by run_suite.
+bool read_suite(const std::string &filename, std::map<std::string, double> &medians)
+{
+    std::ifstream ifs(filename);
+    json::Reader r(ifs);
+    std::string key;
+    if (!ifs || !r.begin_object())
+        return false;
+    while (r.next_key(key))
+    {
+        if (key != "results")
+        {
+            if (!r.skip_value())
+                return false;
+            continue;
+        }
+        if (!r.begin_array())
+            return false;
+        while (r.next_element())
+        {
+            std::string id;
+            double median = -1;
+            if (!r.begin_object())
+                return false;
+            while (r.next_key(key))
+            {
+                bool ok;
+                if (key == "id")
+                    ok = r.read_string(id);
+                else if (key == "median_seconds")
+                    ok = r.read_number(median);
+                else
+                    ok = r.skip_value();
+                if (!ok)
+                    return false;
+            }
+            if (!id.empty() && median >= 0)
+                medians[id] = median;
+        }
+    }
+    return r.good();
+}
+
+//! Compare the medians of two suite files, threshold being the
+//! tolerated slowdown, 0.1 for 10%.
+//! \return The number of regressions, -1 if a file can't be read.
+int compare_suites(const std::string &base, const std::string &current, double threshold)
+{
+    std::map<std::string, double> before, after;
+    if (!read_suite(base, before) || !read_suite(current, after))
+    {
+        std::cout << "Can't read " << base << " or " << current << std::endl;
+        return -1;
+    }
+    int regressions = 0;
+    for (const auto &m : after)
+    {
+        auto b = before.find(m.first);
+        if (b == before.end() || b->second <= 0)
+        {
+            std::cout << m.first << " : new" << std::endl;
+            continue;
+        }
+        const double ratio = m.second / b->second;
+        const bool slower = ratio > 1 + threshold;
+        regressions += slower;
+        std::cout << m.first << " : " << ratio << "x"
+                  << (slower ? " REGRESSION" : "") << std::endl;
+    }
+    return regressions;
+}
+
+/**
+ * Usage: benchmark [check | shared]
+ *
+ *        benchmark suite [results.json]
+ *        benchmark compare base.json results.json [threshold]
+ *
+ * The checks of allocations, kernels, file formats and concurrent
+ * inference run first. With "check", the program stops there and
+ * fails if one of them did. With "shared", only run the stress of
+ * the concurrent const inference, the rest being too slow in a
+ * ThreadSanitizer build, and fail if a thread got different outputs.
+ *
+ * "suite" runs the fixed set of measures meant to be tracked
+ * between releases, on synthetic data, and writes their results to
+ * results.json (benchmark_results.json by default). "compare" lists
+ * the ratio of each median time of results.json to the one of
+ * base.json, and fails if one is slower by more than threshold
+ * (0.1 by default, for 10%).
+ */
+int main(int argc, char **argv)
+{
+    if (argc > 1 && !std::strcmp(argv[1], "suite"))
+    {
+        run_suite(argc > 2 ? argv[2] : "benchmark_results.json");
+        return 0;
+    }
+    if (argc > 3 && !std::strcmp(argv[1], "compare"))
+        return compare_suites(argv[2], argv[3], argc > 4 ? std::atof(argv[4]) : 0.1) != 0;
+
+    if (argc > 1 && !std::strcmp(argv[1], "shared"))
+        return bench_shared<float>({784, 64, 10}, 4, 50, 4) != 0;
+
+    bool checked = check_allocations<float>({84, 15, 10}, 32, 100);
+    checked &= check_allocations<double>({784, 64, 10}, 32, 10);
+    checked &= check_sigmoid<float>();
+    checked &= check_sigmoid<double>();
+    checked &= check_binary<float>();
+    checked &= check_binary<double>();
+    checked &= check_save_file<float>();
+    checked &= check_save_file<double>();
+    checked &= check_labels();
+    checked &= check_images();
+    checked &= bench_shared<float>({784, 64, 10}, 4, 50, 4) == 0;
+    if (argc > 1 && !std::strcmp(argv[1], "check"))
+        return !checked;
+
+    bench_eval<double>({84, 15, 10}, 100000);
+    bench_eval<double>({784, 1024, 1024, 10}, 200);
+    bench_activation<double>({84, 15, 10}, 100000);
+    bench_activation<double>({784, 256, 10}, 1000);
+    bench_sigmoid<float>(4096, 10000);
+    bench_sigmoid<double>(4096, 10000);
+    bench_parallel<float>({784, 256, 10}, 256, 20);
+    bench_model_io<float>({84, 15, 10});
+    bench_model_io<float>({784, 256, 10});
+    bench_model_io<float>({784, 1024, 1024, 10});
+    bench_precision({784, 1024, 1024, 10}, 32, 10);
+    bench_quantized<float>({784, 256, 10}, 2000);
+    bench_quantized<float>({784, 1024, 1024, 10}, 200);
+    for (unsigned int size = 16; size <= 4096; size *= 4)
+    {
+        bench_gemm<float>(size, 64);
+        bench_gemm<double>(size, 64);
+    }
+    bench_sparse<float>({20000, 256, 10}, 0.01, 64, 512);
+    bench_pruned<float>({784, 1024, 1024, 10}, 0.1, 200);
+    bench_plan<float>({84, 15, 10}, 200000);
+    bench_plan<double>({84, 15, 10}, 200000);
+    bench_plan<float>({784, 256, 10}, 10000);
+    bench_plan<float>({784, 1024, 1024, 10}, 500);
+    bench_plan<double>({784, 1024, 1024, 10}, 500);
+    bench_static<float, 84, 15, 10>(200000);
+    bench_static<double, 84, 15, 10>(200000);
+    bench_static<float, 784, 32, 10>(20000);
+    bench_evaluate<float>({784, 256, 10}, 10000);
+    bench_evaluate<double>({784, 256, 10}, 10000);
+    bench_optimizer<float>({84, 15, 10}, 32, 64000);
+    bench_optimizer<float>({784, 256, 10}, 32, 3200);
+    bench_optimizer<double>({784, 256, 10}, 32, 3200);
+    bench_checkpoint<float>({784, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 512, 10},
+                            256, 20);
+    bench_server<float>({784, 1024, 10}, 32, 1, 1, std::chrono::microseconds(0), 100);
+    bench_server<float>({784, 1024, 10}, 32, 1, 8, std::chrono::microseconds(200), 100);
+    bench_server<float>({784, 1024, 10}, 32, 1, 32, std::chrono::microseconds(1000), 100);
+
+    return 0;
+}
@@ -1,12 +1,22 @@
 #include "Layer.hpp"
 #include "Network.hpp"
 #include "MNIST.hpp"
+#include "DataLoader.hpp"
+#include "MixedNetwork.hpp"
+#include "QuantizedNetwork.hpp"
 #include <boost/numeric/ublas/io.hpp>
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+
 using namespace ffnn;
 
-template<typename T>
-int argmax(vector<T> v)
+template<class V>
+int argmax(const V &v)
 {
     int idx = 0;
     for (int i = 1; i < v.size(); i++)
@@ -17,79 +27,392 @@ int argmax(vector<T> v)
     return idx;
 }
 
-int main ()
-{
-    //Create network
+typedef std::chrono::steady_clock steady;
 
-    Layer<double> layer1(84, 15, ffnn::sigmoid<double>, ffnn::sigmoid_prime<double>);
-    Layer<double> layer2(15, 10, ffnn::sigmoid<double>, ffnn::sigmoid_prime<double>);
+//! Train for epochs over the MNIST set, calling step(inputs, outputs)
+//! on each batch, and report the time to the first gradient (since
+//! start) and the steady state speed.
+template<typename T, typename F>
+void train(const MNIST::IdxFile &imgset, const MNIST::IdxFile &labelset,
+           unsigned int batch_size, unsigned int epochs, steady::time_point start, F step)
+{
+    unsigned int samples = 0, b = 0;
+    std::chrono::duration<double> first_gradient(0);
+    auto train_start = steady::now();
+    {
+        // Each batch gets about the label proportions of the whole set.
+        Sampler sampler(imgset.count(), Sampler::Mode::shuffle);
+        sampler.stratify(labelset.item(0));
+        DataLoader<T> loader(imgset, labelset, 10, batch_size, epochs, sampler);
+        const unsigned int batch_count = loader.batch_count();
+        while (const typename DataLoader<T>::Batch *batch = loader.next())
+        {
+            if (b % batch_count == 0)
+                std::cout << "Pass " << batch->epoch << std::endl;
 
-    layer1.randomize();
-    layer2.randomize();
+            step(batch->inputs, batch->outputs);
 
-    Network<double> net;
+            samples += batch_size;
+            if (b++ == 0)
+            {
+                // Steady state speed is measured from here.
+                train_start = steady::now();
+                first_gradient = train_start - start;
+            }
+            if (samples % 1000 < batch_size)
+                std::cout << "Trained: " << samples << "\r" << std::flush;
+        }
+    }
+    std::chrono::duration<double> elapsed = steady::now() - train_start;
+    std::cout << "Time to first gradient : "
+              << first_gradient.count() * 1000 << " ms." << std::endl;
+    // Measured from the end of the first batch: with a single one,
+    // there is nothing to measure.
+    std::cout << "Training speed : ";
+    if (b > 1)
+        std::cout << (samples - batch_size) / elapsed.count() << " samples/s." << std::endl;
+    else
+        std::cout << "n/a" << std::endl;
+}
 
-    if (!net.connect_layer(layer1) || !net.connect_layer(layer2))
+//! With FFNN_PROFILE, print where the training time went and write
+//! the counters and the trace of the first events.
+void report_profile()
+{
+#ifdef FFNN_PROFILE
+    const profile::Profiler &p = profile::profiler();
+    const profile::Phase phases[] = {profile::Phase::forward, profile::Phase::backward,
+                                     profile::Phase::gradients, profile::Phase::update};
+    const double train = p.total(profile::Phase::train).seconds;
+    for (auto phase : phases)
     {
-        std::cout << "Can't connect layers" << std::endl;
+        const profile::Counter c = p.total(phase);
+        if (c.calls)
+            std::cout << "Profile " << profile::phase_name(phase) << " : "
+                      << c.seconds << " s (" << 100 * c.seconds / train << " percent), "
+                      << c.flops / c.seconds * 1e-9 << " GFlop/s." << std::endl;
     }
+    std::cout << "Profile : " << p.samples_per_second() << " samples/s, "
+              << p.allocation_count() << " allocations." << std::endl;
+    std::ofstream json("mnist_profile.json"), trace("mnist_trace.json");
+    p.write_json(json);
+    p.write_trace(trace);
+#endif
+}
 
-    //Convert it to a list of matrices
-    std::vector<vector<double>> img_list;
-    std::vector<mapped_vector<double>> label_list;
+//! Report the percentage of the MNIST set classified right, forward(inputs)
+//! returning the outputs of the network for a batch, and the number
+//! of samples per second going through forward.
+//! \return The percentage.
+template<typename T, typename F>
+float check(const MNIST::IdxFile &imgset, const MNIST::IdxFile &labelset, F forward,
+            double *speed = nullptr)
+{
+    int count = 0, checked = 0;
+    std::chrono::duration<double> elapsed(0);
+    std::cout << "Checking efficiency..." << std::endl;
     {
-        //Load MNIST dataset
-        std::cout << "MNIST loading..." << std::endl;
-        MNIST::ImageSet imgset;
-        imgset.load("train-images-idx3-ubyte");
-        MNIST::LabelSet labelset;
-        labelset.load("train-labels-idx1-ubyte");
-        for (int www = 0; www < 2; www++)
-        for (int i = 0; i < imgset.count; i++)
+        Sampler sampler(imgset.count(), Sampler::Mode::sequential);
+        DataLoader<T> loader(imgset, labelset, 10, 100, 1, sampler);
+        while (const typename DataLoader<T>::Batch *batch = loader.next())
         {
-            vector<double> img(imgset.images[i].size());
-            for (int j = 0; j < imgset.images[i].size(); j++)
-                img[j] = imgset.images[i][j] / 255.0;
+            auto forward_start = steady::now();
+            const matrix<T> &outputs = forward(batch->inputs);
+            elapsed += steady::now() - forward_start;
+            for (unsigned int j = 0; j < outputs.size2(); j++)
+                count += argmax(column(outputs, j)) == argmax(column(batch->outputs, j));
+            checked += outputs.size2();
 
-            if (i % 1000 == 0)
-                std::cout << "Loaded: " << i << "\r" << std::flush;
-
-            img_list.push_back(std::move(img));
-            label_list.push_back(unit_vector<double>(10, labelset.labels[i]));
+            if (checked % 1000 == 0)
+                std::cout << "Checked: " << checked << "\r" << std::flush;
         }
     }
-    std::cout << "MNIST Loaded     " << std::endl;
+    const float efficiency = 100 * (float)count / (float)checked;
+    std::cout << "Efficiency : " << efficiency << " percent ("
+              << checked / elapsed.count() << " samples/s)." << std::endl;
+    if (speed)
+        *speed = checked / elapsed.count();
+    return efficiency;
+}
 
-    //Training network
-    std::cout << "Training network..." << std::endl;
-    for (int z = 0; z < 4; z++)
+//! Report the accuracy, the mean loss and the confusion matrix of
+//! net on a whole set, evaluated by batches over the threads of pool.
+template<typename T>
+void evaluate(const Network<T> &net, ThreadPool &pool, const MNIST::IdxFile &imgset,
+              const MNIST::IdxFile &labelset)
+{
+    std::cout << "Evaluating..." << std::endl;
+    std::vector<Workspace<T>> workspaces;
+    Evaluation result(10);
+    // The set is converted by chunks, not to hold all of it as T.
+    const unsigned int chunk = 4096;
+    matrix<T> inputs, outputs;
+    auto start = steady::now();
+    for (unsigned int first = 0; first < imgset.count(); first += chunk)
     {
-        std::cout << "Pass " << z << std::endl;
-        for (int i = 0; i < img_list.size() ; i++)
+        const unsigned int n = std::min(chunk, imgset.count() - first);
+        if (inputs.size2() != n)
         {
-            net.train(1, img_list[i], label_list[i]);
+            inputs.resize(784, n, false);
+            outputs.resize(10, n, false);
+        }
+        MNIST::images_to_batch(imgset, first, inputs);
+        MNIST::labels_to_batch(labelset, first, outputs);
+        net.evaluate(pool, workspaces, inputs, outputs, result);
+    }
+    std::chrono::duration<double> elapsed = steady::now() - start;
 
-            if (i % 1000 == 0)
-                std::cout << "Trained: " << i << "\r" << std::flush;
+    std::cout << "Accuracy : " << 100 * result.accuracy() << " percent, loss "
+              << result.mean_loss() << " (" << result.samples / elapsed.count()
+              << " samples/s)." << std::endl;
+    std::cout << "Confusion (expected by row, predicted by column) :" << std::endl;
+    for (unsigned int i = 0; i < 10; i++)
+    {
+        for (unsigned int j = 0; j < 10; j++)
+            std::cout << " " << std::setw(5) << result.confusion(i, j);
+        std::cout << std::endl;
+    }
+}
+
+//! Compare the int8 version of net with net, one sample at a time
+//! as when serving, on the given set.
+template<typename T>
+void check_quantized(const Network<T> &net, const MNIST::IdxFile &imgset,
+                     const MNIST::IdxFile &testset, const MNIST::IdxFile &testlabels)
+{
+    // Calibrated on the first images of the training set.
+    matrix<T> calibration(784, std::min(1000u, imgset.count()));
+    MNIST::images_to_batch(imgset, 0u, calibration);
+    QuantizedNetwork<T> quantized(net, calibration);
+
+    std::size_t size = 0;
+    for (const auto &layer : net.get_layers())
+        size += (layer.get_weights().size1() * layer.get_weights().size2()
+                 + layer.get_biases().size()) * sizeof(T);
+    std::cout << "Model size : " << size << " bytes, int8 "
+              << quantized.storage_size() << " bytes." << std::endl;
+
+    Workspace<T> ws;
+    typename QuantizedNetwork<T>::Scratch scratch;
+    vector<T> input(784);
+    matrix<T> outputs;
+    double reference_speed, quantized_speed;
+
+    std::cout << "Reference model:" << std::endl;
+    float reference = check<T>(testset, testlabels, [&](const matrix<T> &inputs) -> const matrix<T> & {
+        outputs.resize(10, inputs.size2(), false);
+        for (unsigned int j = 0; j < inputs.size2(); j++)
+            noalias(column(outputs, j)) = net.eval(ws, column(inputs, j));
+        return outputs;
+    }, &reference_speed);
+
+    std::cout << "int8 model:" << std::endl;
+    float efficiency = check<T>(testset, testlabels, [&](const matrix<T> &inputs) -> const matrix<T> & {
+        outputs.resize(10, inputs.size2(), false);
+        for (unsigned int j = 0; j < inputs.size2(); j++)
+        {
+            noalias(input) = column(inputs, j);
+            noalias(column(outputs, j)) = quantized.eval(scratch, input);
         }
+        return outputs;
+    }, &quantized_speed);
+
+    std::cout << "int8 efficiency delta : " << efficiency - reference
+              << " percent, speedup : " << quantized_speed / reference_speed
+              << "x." << std::endl;
+}
+
+template<typename T>
+Network<T> make_network()
+{
+    Layer<T> layer1(784, 15, ffnn::sigmoid<T>, ffnn::sigmoid_prime<T>);
+    Layer<T> layer2(15, 10, ffnn::sigmoid<T>, ffnn::sigmoid_prime<T>);
+
+    layer1.randomize();
+    layer2.randomize();
+
+    Network<T> net;
+
+    if (!net.connect_layer(layer1) || !net.connect_layer(layer2))
+    {
+        std::cout << "Can't connect layers" << std::endl;
     }
+    return net;
+}
+
+//! The optimizer of mode, null for plain gradient descent.
+template<typename T>
+std::unique_ptr<Optimizer<T>> make_optimizer(const char *mode)
+{
+    if (!std::strcmp(mode, "momentum"))
+        return std::unique_ptr<Optimizer<T>>(new Momentum<T>(0.3, 0.9));
+    if (!std::strcmp(mode, "nesterov"))
+        return std::unique_ptr<Optimizer<T>>(new Nesterov<T>(0.3, 0.9));
+    if (!std::strcmp(mode, "adam"))
+        return std::unique_ptr<Optimizer<T>>(new Adam<T>(0.01));
+    return std::unique_ptr<Optimizer<T>>();
+}
+
+template<typename T>
+void run(const char *mode, unsigned int threads, const MNIST::IdxFile &imgset,
+         const MNIST::IdxFile &labelset, const MNIST::IdxFile &testset,
+         const MNIST::IdxFile &testlabels, steady::time_point start)
+{
+    const unsigned int epochs = 8;
+    std::unique_ptr<Optimizer<T>> optimizer = make_optimizer<T>(mode);
+    const bool batched = !std::strcmp(mode, "batch") || !std::strcmp(mode, "parallel") || optimizer;
+    // The serial and hogwild modes train sample by sample, larger
+    // batches only mean fewer hand-offs with the loader.
+    const unsigned int batch_size = batched ? 32 : 256;
+
+    Network<T> net = make_network<T>();
 
+    //Training network
+    std::cout << "Training network (" << mode << ")..." << std::endl;
+    ThreadPool pool(threads);
+    Workspace<T> ws;
+    std::vector<Workspace<T>> workspaces;
+    compressed_vector<T> sparse_input(784);
+    train<T>(imgset, labelset, batch_size, epochs, start,
+             [&](const matrix<T> &inputs, const matrix<T> &outputs) {
+        if (!std::strcmp(mode, "hogwild"))
+            net.train_async(pool, workspaces, 1, inputs, outputs);
+        else if (!std::strcmp(mode, "batch"))
+            net.train_batch(ws, 3, inputs, outputs);
+        else if (optimizer)
+            net.train_batch(ws, *optimizer, inputs, outputs);
+        else if (!std::strcmp(mode, "parallel"))
+            net.train_batch(pool, workspaces, 3, inputs, outputs);
+        else if (!std::strcmp(mode, "sparse"))
+            for (unsigned int j = 0; j < inputs.size2(); j++)
+            {
+                // Only the nonzero pixels, about a fifth, are stored.
+                sparse_input = column(inputs, j);
+                net.train(ws, 1, sparse_input, column(outputs, j));
+            }
+        else
+            for (unsigned int j = 0; j < inputs.size2(); j++)
+                net.train(ws, 1, column(inputs, j), column(outputs, j));
+    });
+    report_profile();
 
     //Checking efficiency
-    int count = 0;
-    std::cout << "Checking efficiency..." << std::endl;
-    for (int i = 0; i < img_list.size(); i++)
-    {
-        count += argmax(net.eval(img_list[i])) == argmax(vector<double>(label_list[i]));
+    evaluate(net, pool, testset, testlabels);
 
-        if (i % 1000 == 0)
-            std::cout << "Checked: " << i << "\r" << std::flush;
-    }
-    std::cout << "Efficiency : "
-              << 100 * (float)count / (float)img_list.size()
-              << " percent." << std::endl;
+    //Quantizing to int8
+    check_quantized(net, imgset, testset, testlabels);
 
     net.save_file("mnist_network.json");
+}
+
+//! Mixed precision training, with weights stored as S and a float
+//! master, then training of a Network<float> from the same initial
+//! weights on the same batches, and comparison of their accuracy on
+//! the test set.
+//! \return false if the mixed precision accuracy is more than
+//!         max_loss percentage points below the float one.
+template<typename S>
+bool run_mixed(const char *mode, const MNIST::IdxFile &imgset, const MNIST::IdxFile &labelset,
+               const MNIST::IdxFile &testset, const MNIST::IdxFile &testlabels,
+               steady::time_point start, float max_loss = 1)
+{
+    const Network<float> initial = make_network<float>();
+    MixedNetwork<S> net(initial);
+    std::cout << "Weights stored in " << net.storage_size() << " bytes" << std::endl;
+
+    std::cout << "Training network (" << mode << ")..." << std::endl;
+    Workspace<float> ws;
+    train<float>(imgset, labelset, 32, 8, start,
+                 [&](const matrix<float> &inputs, const matrix<float> &outputs) {
+        net.train_batch(ws, 3, inputs, outputs);
+    });
+    report_profile();
+
+    // The sampler being seeded the same way, the batches are the same.
+    std::cout << "Training the float reference..." << std::endl;
+    Network<float> reference = initial;
+    train<float>(imgset, labelset, 32, 8, steady::now(),
+                 [&](const matrix<float> &inputs, const matrix<float> &outputs) {
+        reference.train_batch(ws, 3, inputs, outputs);
+    });
+
+    std::cout << "With the " << mode << " weights:" << std::endl;
+    const float mixed = check<float>(testset, testlabels, [&](const matrix<float> &inputs) -> const matrix<float> & {
+        net.forward_batch(ws, inputs);
+        return ws.batch_activations.back();
+    });
+    std::cout << "With the float reference:" << std::endl;
+    const float expected = check<float>(testset, testlabels, [&](const matrix<float> &inputs) -> const matrix<float> & {
+        reference.forward_batch(ws, inputs);
+        return ws.batch_activations.back();
+    });
+    const bool parity = mixed >= expected - max_loss;
+    std::cout << "Accuracy difference : " << mixed - expected << " percent"
+              << (parity ? "" : " (FAILED)") << std::endl;
+
+    net.get_master().save_file("mnist_network.json");
+    return parity;
+}
+
+/**
+ * Usage: mnist_network [mode [threads [type]]]
+ *
+ * mode is one of:
+ *  serial    one train() call per sample (default)
+ *  batch     train_batch() on mini-batches
+ *  parallel  data-parallel train_batch() over threads
+ *  hogwild   lock-free train_async() over threads
+ *  sparse    one train() call per sample, with sparse inputs
+ *  fp16      train_batch() with half weights and a float master,
+ *            compared with float training
+ *  bf16      the same with bfloat16 weights
+ *  momentum  train_batch() with momentum
+ *  nesterov  train_batch() with Nesterov momentum
+ *  adam      train_batch() with Adam
+ * threads defaults to the number of cores.
+ * type is double (default) or float, fp16 and bf16 always use float.
+ * fp16 and bf16 fail if their accuracy on the test set is more than
+ * one percentage point below the one of the float training.
+ *
+ * Built with -DPROFILE=ON, the time spent in each phase of the
+ * training is printed, and written to mnist_profile.json with the
+ * Chrome trace of its first events in mnist_trace.json.
+ */
+int main (int argc, char **argv)
+{
+    const auto start = steady::now();
+
+    const char *mode = argc > 1 ? argv[1] : "serial";
+    const unsigned int threads = argc > 2 ? std::atoi(argv[2]) : 0;
+    const char *type = argc > 3 ? argv[3] : "double";
+
+    //Map MNIST dataset, the images are read and converted while training
+    MNIST::MappedImageSet imgset;
+    MNIST::MappedLabelSet labelset;
+    if (!imgset.load("train-images-idx3-ubyte") || !labelset.load("train-labels-idx1-ubyte")
+        || imgset.item_size() != 784 || labelset.count() != imgset.count()
+        || !MNIST::labels_below(labelset, 10))
+    {
+        std::cout << "Can't load MNIST" << std::endl;
+        return 1;
+    }
+    //The test set, the training set being used instead when it is missing
+    MNIST::MappedImageSet testset;
+    MNIST::MappedLabelSet testlabels;
+    const bool has_test = testset.load("t10k-images-idx3-ubyte")
+        && testlabels.load("t10k-labels-idx1-ubyte") && testset.item_size() == 784
+        && testlabels.count() == testset.count() && MNIST::labels_below(testlabels, 10);
+    const MNIST::IdxFile &test_images = has_test ? testset : imgset;
+    const MNIST::IdxFile &test_labels = has_test ? testlabels : labelset;
+
+    if (!std::strcmp(mode, "fp16"))
+        return !run_mixed<half>(mode, imgset, labelset, test_images, test_labels, start);
+    else if (!std::strcmp(mode, "bf16"))
+        return !run_mixed<bfloat16>(mode, imgset, labelset, test_images, test_labels, start);
+    else if (!std::strcmp(type, "float"))
+        run<float>(mode, threads, imgset, labelset, test_images, test_labels, start);
+    else
+        run<double>(mode, threads, imgset, labelset, test_images, test_labels, start);
 
     return 0;
 }
@@ -0,0 +1,273 @@
+#ifndef ACTIVATION_HPP_
+#define ACTIVATION_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <cmath>
+
+#include "Simd.hpp"
+
+/**
+ * This file implement the activation functions known at compile
+ * time. Each one is a policy with static member functions working
+ * on a whole buffer, so that the elementwise loop is a plain loop
+ * over contiguous memory that the compiler can inline and vectorize,
+ * instead of one std::function call per element.
+ *
+ * A buffer is a row major rows x cols matrix where each column
+ * is a sample (a vector being a single column). Only softmax
+ * cares about the columns, for its value and its derivative, the
+ * other ones are elementwise.
+ *
+ * The derivative is always expressed as a function of the
+ * activation a = f(z), not of z.
+ */
+
+namespace ffnn
+{
+    template<typename T>
+    T sigmoid(const T x)
+    {
+        using std::exp;
+        return static_cast<T>(1) / (static_cast<T>(1) + exp(-x));
+    };
+
+    template<typename T>
+    T sigmoid_prime(const T a)
+    {
+        return a * (static_cast<T>(1) - a);
+    };
+
+    //! Identifier of an activation function, used to dispatch
+    //! at runtime and to serialize layers.
+    enum class ActivationId : unsigned char
+    {
+        custom = 0,
+        sigmoid = 1,
+        tanh = 2,
+        relu = 3,
+        identity = 4,
+        softmax = 5
+    };
+
+    //! Base of the elementwise activations. Derived must
+    //! provide the scalar apply_one(z) and derivative_one(a).
+    template<typename Derived>
+    struct ElementwiseActivation
+    {
+        template<typename T>
+        static void apply(T *data, std::size_t rows, std::size_t cols)
+        {
+            const std::size_t n = rows * cols;
+            for (std::size_t i = 0; i < n; i++)
+                data[i] = Derived::apply_one(data[i]);
+        }
+
+        //! Add bias[i] to each value of the row i, then apply.
+        template<typename T>
+        static void apply(T *data, const T *bias, std::size_t rows, std::size_t cols)
+        {
+            for (std::size_t i = 0; i < rows; i++)
+                for (std::size_t j = 0; j < cols; j++)
+                    data[i * cols + j] = Derived::apply_one(data[i * cols + j] + bias[i]);
+        }
+
+        //! delta *= f'(a), element by element.
+        template<typename T>
+        static void derivative_mask(T *delta, const T *a, std::size_t rows, std::size_t cols)
+        {
+            const std::size_t n = rows * cols;
+            for (std::size_t i = 0; i < n; i++)
+                delta[i] *= Derived::derivative_one(a[i]);
+        }
+    };
+
+    //! The buffer functions use the vectorized kernels of Simd.hpp.
+    struct Sigmoid
+    {
+        static const ActivationId id = ActivationId::sigmoid;
+        template<typename T>
+        static T apply_one(T z) {return sigmoid(z);}
+        template<typename T>
+        static T derivative_one(T a) {return sigmoid_prime(a);}
+
+        template<typename T>
+        static void apply(T *data, std::size_t rows, std::size_t cols)
+        {
+            simd::sigmoid(data, rows * cols);
+        }
+
+        template<typename T>
+        static void apply(T *data, const T *bias, std::size_t rows, std::size_t cols)
+        {
+            simd::bias_sigmoid(data, bias, rows, cols);
+        }
+
+        template<typename T>
+        static void derivative_mask(T *delta, const T *a, std::size_t rows, std::size_t cols)
+        {
+            simd::sigmoid_prime_mask(delta, a, rows * cols);
+        }
+    };
+
+    struct Tanh : ElementwiseActivation<Tanh>
+    {
+        static const ActivationId id = ActivationId::tanh;
+        template<typename T>
+        static T apply_one(T z) {return std::tanh(z);}
+        template<typename T>
+        static T derivative_one(T a) {return static_cast<T>(1) - a * a;}
+    };
+
+    struct ReLU : ElementwiseActivation<ReLU>
+    {
+        static const ActivationId id = ActivationId::relu;
+        template<typename T>
+        static T apply_one(T z) {return z > T(0) ? z : T(0);}
+        template<typename T>
+        static T derivative_one(T a) {return a > T(0) ? T(1) : T(0);}
+    };
+
+    struct Identity : ElementwiseActivation<Identity>
+    {
+        static const ActivationId id = ActivationId::identity;
+        template<typename T>
+        static T apply_one(T z) {return z;}
+        template<typename T>
+        static T derivative_one(T) {return T(1);}
+    };
+
+    //! Softmax over each column. Its jacobian isn't diagonal: the
+    //! derivative mask of a column is the product of the jacobian
+    //! with it, delta_i = a_i (delta_i - sum_j delta_j a_j).
+    struct Softmax
+    {
+        static const ActivationId id = ActivationId::softmax;
+
+        template<typename T>
+        static void apply(T *data, std::size_t rows, std::size_t cols)
+        {
+            for (std::size_t j = 0; j < cols; j++)
+            {
+                T max = data[j];
+                for (std::size_t i = 1; i < rows; i++)
+                    max = std::max(max, data[i * cols + j]);
+                T sum = 0;
+                for (std::size_t i = 0; i < rows; i++)
+                {
+                    T &v = data[i * cols + j];
+                    v = std::exp(v - max);
+                    sum += v;
+                }
+                for (std::size_t i = 0; i < rows; i++)
+                    data[i * cols + j] /= sum;
+            }
+        }
+
+        template<typename T>
+        static void apply(T *data, const T *bias, std::size_t rows, std::size_t cols)
+        {
+            for (std::size_t i = 0; i < rows; i++)
+                for (std::size_t j = 0; j < cols; j++)
+                    data[i * cols + j] += bias[i];
+            apply(data, rows, cols);
+        }
+
+        template<typename T>
+        static void derivative_mask(T *delta, const T *a, std::size_t rows, std::size_t cols)
+        {
+            for (std::size_t j = 0; j < cols; j++)
+            {
+                T dot = 0;
+                for (std::size_t i = 0; i < rows; i++)
+                    dot += delta[i * cols + j] * a[i * cols + j];
+                for (std::size_t i = 0; i < rows; i++)
+                {
+                    T &d = delta[i * cols + j];
+                    d = a[i * cols + j] * (d - dot);
+                }
+            }
+        }
+    };
+
+    //! Apply the activation id to data, see the top of this file
+    //! for the layout. Return false if id is custom.
+    template<typename T>
+    bool activate(ActivationId id, T *data, std::size_t rows, std::size_t cols)
+    {
+        switch (id)
+        {
+        case ActivationId::sigmoid: Sigmoid::apply(data, rows, cols); return true;
+        case ActivationId::tanh: Tanh::apply(data, rows, cols); return true;
+        case ActivationId::relu: ReLU::apply(data, rows, cols); return true;
+        case ActivationId::identity: Identity::apply(data, rows, cols); return true;
+        case ActivationId::softmax: Softmax::apply(data, rows, cols); return true;
+        default: return false;
+        }
+    }
+
+    //! Add bias[i] to the row i of data, then apply the activation
+    //! id, in a single pass. Return false if id is custom.
+    template<typename T>
+    bool activate(ActivationId id, T *data, const T *bias, std::size_t rows, std::size_t cols)
+    {
+        switch (id)
+        {
+        case ActivationId::sigmoid: Sigmoid::apply(data, bias, rows, cols); return true;
+        case ActivationId::tanh: Tanh::apply(data, bias, rows, cols); return true;
+        case ActivationId::relu: ReLU::apply(data, bias, rows, cols); return true;
+        case ActivationId::identity: Identity::apply(data, bias, rows, cols); return true;
+        case ActivationId::softmax: Softmax::apply(data, bias, rows, cols); return true;
+        default: return false;
+        }
+    }
+
+    //! Multiply delta by the derivative of the activation id taken
+    //! at a, both laid out as the top of this file says. Return false
+    //! if id is custom.
+    template<typename T>
+    bool derivative_mask(ActivationId id, T *delta, const T *a, std::size_t rows, std::size_t cols)
+    {
+        switch (id)
+        {
+        case ActivationId::sigmoid: Sigmoid::derivative_mask(delta, a, rows, cols); return true;
+        case ActivationId::tanh: Tanh::derivative_mask(delta, a, rows, cols); return true;
+        case ActivationId::relu: ReLU::derivative_mask(delta, a, rows, cols); return true;
+        case ActivationId::identity: Identity::derivative_mask(delta, a, rows, cols); return true;
+        case ActivationId::softmax: Softmax::derivative_mask(delta, a, rows, cols); return true;
+        default: return false;
+        }
+    }
+
+    //! Name used to serialize an activation.
+    inline const char *activation_name(ActivationId id)
+    {
+        switch (id)
+        {
+        case ActivationId::sigmoid: return "sigmoid";
+        case ActivationId::tanh: return "tanh";
+        case ActivationId::relu: return "relu";
+        case ActivationId::identity: return "identity";
+        case ActivationId::softmax: return "softmax";
+        default: return "custom";
+        }
+    }
+
+    //! Inverse of activation_name. Return false if name
+    //! isn't a known activation.
+    inline bool activation_from_name(const std::string &name, ActivationId &id)
+    {
+        for (unsigned char i = 1; i <= static_cast<unsigned char>(ActivationId::softmax); i++)
+        {
+            if (name == activation_name(static_cast<ActivationId>(i)))
+            {
+                id = static_cast<ActivationId>(i);
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+#endif /* !ACTIVATION_HPP_ */
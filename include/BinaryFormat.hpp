@@ -0,0 +1,123 @@
+#ifndef BINARYFORMAT_HPP_
+#define BINARYFORMAT_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include "Activation.hpp"
+
+/**
+ * This file describe the binary model format written by
+ * Network::save_binary and read by Network::load_binary
+ * and MappedNetwork.
+ *
+ * The file is made of, in native byte order:
+ *  - a Header,
+ *  - one LayerEntry per layer,
+ *  - the weights (row major, output_size x input_size) and the
+ *    biases of each layer, as raw T, each blob starting at an
+ *    offset multiple of blob_alignment.
+ *
+ * The blobs can therefore be used in place once the file is
+ * mapped in memory. The byte order marker allow to reject a
+ * file written on a machine of a different endianness.
+ */
+
+namespace ffnn
+{
+namespace binary
+{
+    const char magic[8] = {'F', 'F', 'N', 'N', 'B', 'I', 'N', '\0'};
+    const std::uint32_t version = 1;
+    const std::uint32_t byte_order = 0x01020304;
+    const std::size_t blob_alignment = 64;
+
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        //! scalar_code<T>() of the weights.
+        std::uint32_t scalar;
+        std::uint32_t layer_count;
+    };
+
+    struct LayerEntry
+    {
+        std::uint32_t input_size;
+        std::uint32_t output_size;
+        //! An ActivationId, never custom.
+        std::uint32_t activation;
+        std::uint32_t reserved;
+        std::uint64_t weights_offset;
+        std::uint64_t biases_offset;
+    };
+
+    //! Identify the scalar type stored in a file.
+    //! 0 means the type can't be stored.
+    template<typename T>
+    std::uint32_t scalar_code() {return 0;}
+    template<>
+    inline std::uint32_t scalar_code<float>() {return 1;}
+    template<>
+    inline std::uint32_t scalar_code<double>() {return 2;}
+
+    //! Round offset up to the next multiple of blob_alignment.
+    inline std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + blob_alignment - 1) / blob_alignment * blob_alignment;
+    }
+
+    //! Check that the size bytes starting at data are a valid model
+    //! made of T. The data must be aligned on blob_alignment.
+    //! The sizes and offsets come from the file: they are compared
+    //! so that no sum or product can wrap around.
+    template<typename T>
+    bool check(const char *data, std::size_t size)
+    {
+        if (size < sizeof(Header))
+            return false;
+        const Header *header = reinterpret_cast<const Header *>(data);
+        if (std::memcmp(header->magic, magic, sizeof(magic))
+            || header->version != version
+            || header->byte_order != byte_order
+            || header->scalar != scalar_code<T>()
+            || header->scalar == 0)
+            return false;
+
+        const std::uint64_t table_end = sizeof(Header)
+            + std::uint64_t(header->layer_count) * sizeof(LayerEntry);
+        if (table_end > size)
+            return false;
+
+        const LayerEntry *entries = reinterpret_cast<const LayerEntry *>(header + 1);
+        for (std::uint32_t l = 0; l < header->layer_count; l++)
+        {
+            const LayerEntry &e = entries[l];
+            if (e.input_size == 0 || e.output_size == 0)
+                return false;
+            if (l > 0 && entries[l - 1].output_size != e.input_size)
+                return false;
+            if (e.activation == static_cast<std::uint32_t>(ActivationId::custom)
+                || e.activation > static_cast<std::uint32_t>(ActivationId::softmax))
+                return false;
+
+            const std::uint64_t max = std::numeric_limits<std::uint64_t>::max();
+            if (e.output_size > max / e.input_size / sizeof(T))
+                return false;
+            const std::uint64_t weights_size = std::uint64_t(e.input_size) * e.output_size * sizeof(T);
+            const std::uint64_t biases_size = std::uint64_t(e.output_size) * sizeof(T);
+            if (e.weights_offset % blob_alignment || e.biases_offset % blob_alignment
+                || e.weights_offset < table_end || e.biases_offset < table_end
+                || e.weights_offset > size || weights_size > size - e.weights_offset
+                || e.biases_offset > size || biases_size > size - e.biases_offset)
+                return false;
+        }
+        return true;
+    }
+}
+}
+
+#endif /* !BINARYFORMAT_HPP_ */
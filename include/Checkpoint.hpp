@@ -0,0 +1,213 @@
+#ifndef CHECKPOINT_HPP_
+#define CHECKPOINT_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace ffnn
+{
+    template<typename T>
+    class Layer;
+
+    /**
+     * Layout of the buffers of Network::compute_gradients(ws, plan,
+     * inputs, outputs), which trades memory for computation: the
+     * forward pass only keeps the activations of a few layers, the
+     * checkpoints, and the backward pass recomputes the other ones
+     * from the checkpoint before them, one segment at a time.
+     *
+     * Activation 0 is the input and activation i the output of layer
+     * i - 1, as in Workspace::batch_activations. The segment starting
+     * at checkpoint c ends before the next one, or at the output for
+     * the last segment, whose activations are left by the forward
+     * pass and don't need to be recomputed. The deltas only use two
+     * buffers, each layer computing its delta from the one after it.
+     *
+     * Every activation and delta lives in a single buffer,
+     * Workspace::checkpoint_buffer, at an offset proportional to the
+     * batch size: a plan made for a batch size also works for smaller
+     * batches, with less memory.
+     */
+    struct CheckpointPlan
+    {
+        CheckpointPlan()
+            :values(0), bytes(0), recomputed_flops(0)
+        {
+            delta_offsets[0] = delta_offsets[1] = 0;
+        };
+
+        //! Indices of the activations kept, the input first.
+        std::vector<unsigned int> checkpoints;
+        //! Offset of each activation in the buffer, per sample: the
+        //! activation i of a batch of B samples starts at offsets[i] * B.
+        //! The activations of different segments overlap.
+        std::vector<std::size_t> offsets;
+        //! Offsets of the two delta buffers, in the same unit.
+        std::size_t delta_offsets[2];
+        //! Number of values of the buffer per sample.
+        std::size_t values;
+        //! Size of the buffer for the batch size the plan was made for.
+        std::size_t bytes;
+        //! Floating point operations of the recomputed forward
+        //! products, for the same batch size.
+        std::uint64_t recomputed_flops;
+    };
+
+    namespace detail
+    {
+        //! Number of values per sample of the activations of layers,
+        //! the input first.
+        template<typename T>
+        std::vector<std::size_t> activation_sizes(const std::vector<Layer<T>> &layers)
+        {
+            std::vector<std::size_t> sizes(layers.size() + 1, 0);
+            if (!layers.empty())
+                sizes[0] = layers.front().get_input_size();
+            for (unsigned int i = 0; i < layers.size(); i++)
+                sizes[i + 1] = layers[i].get_output_size();
+            return sizes;
+        }
+
+        //! Fill the offsets, values, bytes and recomputed_flops of
+        //! plan from its checkpoints. The kept activations come first,
+        //! then the segment being recomputed, then the two deltas.
+        inline void layout_checkpoints(const std::vector<std::size_t> &sizes, unsigned int batch_size,
+                                       std::size_t value_size, CheckpointPlan &plan)
+        {
+            const unsigned int L = sizes.size() - 1;
+            const std::vector<unsigned int> &c = plan.checkpoints;
+            plan.offsets.assign(L + 1, 0);
+            plan.recomputed_flops = 0;
+
+            std::size_t kept = 0;
+            for (unsigned int j = 0; j < c.size(); j++)
+            {
+                plan.offsets[c[j]] = kept;
+                kept += sizes[c[j]];
+            }
+            std::size_t segment = 0;
+            for (unsigned int j = 0; j < c.size(); j++)
+            {
+                const bool last = j + 1 == c.size();
+                const unsigned int end = last ? L + 1 : c[j + 1];
+                std::size_t offset = kept;
+                for (unsigned int i = c[j] + 1; i < end; i++)
+                {
+                    plan.offsets[i] = offset;
+                    offset += sizes[i];
+                    if (!last)
+                        plan.recomputed_flops += 2 * std::uint64_t(batch_size) * sizes[i - 1] * sizes[i];
+                }
+                segment = std::max(segment, offset - kept);
+            }
+            const std::size_t delta = *std::max_element(sizes.begin() + 1, sizes.end());
+            plan.delta_offsets[0] = kept + segment;
+            plan.delta_offsets[1] = kept + segment + delta;
+            plan.values = kept + segment + 2 * delta;
+            plan.bytes = plan.values * batch_size * value_size;
+        }
+    }
+
+    //! Bytes of Workspace::batch_activations and batch_deltas, as
+    //! sized by Network::compute_gradients(ws, inputs, outputs) for
+    //! batch_size samples: what a CheckpointPlan saves on.
+    template<typename T>
+    std::size_t batch_activation_bytes(const std::vector<Layer<T>> &layers, unsigned int batch_size)
+    {
+        const std::vector<std::size_t> sizes = detail::activation_sizes(layers);
+        std::size_t values = sizes[0];
+        for (unsigned int i = 1; i < sizes.size(); i++)
+            values += 2 * sizes[i];
+        return values * batch_size * sizeof(T);
+    }
+
+    /**
+     * Choose the checkpoints of layers for batches of batch_size
+     * samples, so that the buffer takes at most budget bytes.
+     *
+     * The search tries each possible size of the largest segment,
+     * finding for it the checkpoints keeping the least values, in
+     * O(L^4) for L layers: meant for networks of tens of layers.
+     * Among these plans, plan is set to the one fitting the budget
+     * which recomputes the fewest operations, then uses the least
+     * memory. With a large enough budget, every activation but the
+     * output is a checkpoint and nothing is recomputed, which still
+     * saves the deltas of all the layers but two.
+     *
+     * \return false if no plan fits, plan being then the one using
+     *         the least memory.
+     */
+    template<typename T>
+    bool plan_checkpoints(const std::vector<Layer<T>> &layers, unsigned int batch_size,
+                          std::size_t budget, CheckpointPlan &plan)
+    {
+        plan = CheckpointPlan();
+        if (layers.empty())
+            return true;
+        const std::vector<std::size_t> sizes = detail::activation_sizes(layers);
+        const unsigned int L = layers.size();
+
+        // Values of the segment from checkpoint c to the next one e,
+        // the output being included when e is L.
+        auto segment = [&](unsigned int c, unsigned int e) -> std::size_t {
+            std::size_t v = 0;
+            for (unsigned int i = c + 1; i < e; i++)
+                v += sizes[i];
+            return e == L ? v + sizes[L] : v;
+        };
+        std::vector<std::size_t> limits;
+        for (unsigned int c = 0; c < L; c++)
+            for (unsigned int e = c + 1; e <= L; e++)
+                limits.push_back(segment(c, e));
+        std::sort(limits.begin(), limits.end());
+        limits.erase(std::unique(limits.begin(), limits.end()), limits.end());
+
+        const std::size_t none = std::numeric_limits<std::size_t>::max();
+        bool fits = false;
+        CheckpointPlan candidate;
+        for (std::size_t limit : limits)
+        {
+            // kept[c] is the least number of values kept from c on,
+            // c being a checkpoint and no segment exceeding limit, and
+            // next[c] the checkpoint after c, or L.
+            std::vector<std::size_t> kept(L + 1, none);
+            std::vector<unsigned int> next(L + 1, L);
+            kept[L] = 0;
+            for (unsigned int c = L; c-- > 0;)
+                for (unsigned int e = c + 1; e <= L; e++)
+                    if (kept[e] != none && segment(c, e) <= limit
+                        && (kept[c] == none || sizes[c] + kept[e] < kept[c]))
+                    {
+                        kept[c] = sizes[c] + kept[e];
+                        next[c] = e;
+                    }
+            if (kept[0] == none)
+                continue;
+
+            candidate.checkpoints.clear();
+            for (unsigned int c = 0; c < L; c = next[c])
+                candidate.checkpoints.push_back(c);
+            detail::layout_checkpoints(sizes, batch_size, sizeof(T), candidate);
+
+            const bool candidate_fits = candidate.bytes <= budget;
+            bool better;
+            if (plan.checkpoints.empty() || candidate_fits != fits)
+                better = plan.checkpoints.empty() || candidate_fits;
+            else if (fits && candidate.recomputed_flops != plan.recomputed_flops)
+                better = candidate.recomputed_flops < plan.recomputed_flops;
+            else
+                better = candidate.bytes < plan.bytes;
+            if (better)
+            {
+                plan = candidate;
+                fits = candidate_fits;
+            }
+        }
+        return fits;
+    }
+}
+
+#endif /* !CHECKPOINT_HPP_ */
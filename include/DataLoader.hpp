@@ -0,0 +1,189 @@
+#ifndef DATALOADER_HPP_
+#define DATALOADER_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/numeric/ublas/matrix.hpp>
+
+#include "MNIST.hpp"
+#include "Sampler.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * Produce the training batches of an image set and its label
+     * set in a background thread.
+     *
+     * The thread draws the samples of each epoch from a Sampler,
+     * converts them to T and fills batches ahead of the trainer, in
+     * a fixed set of buffers: while a batch is used, the next ones
+     * are being prepared. The sets being memory mapped, reading the
+     * files is also done by this thread, the first time each page is
+     * used.
+     *
+     * Each epoch is made of batch_count() full batches, the
+     * samples left over being dropped (a different subset each
+     * epoch when the sampler is random). The labels are all checked
+     * once against the number of classes: with a label out of range,
+     * there are no batches at all.
+     */
+    template<typename T>
+    class DataLoader
+    {
+    public:
+        struct Batch
+        {
+            //! One image per column, scaled to [0, 1].
+            matrix<T> inputs;
+            //! One one-hot label per column.
+            matrix<T> outputs;
+            //! Epoch the batch belongs to.
+            unsigned int epoch;
+        };
+
+        //! Start producing the batches. images and labels must stay
+        //! open while the loader exists.
+        //! \param classes Number of rows of the outputs.
+        //! \param sampler Order of the samples, copied. Its size must
+        //!                be the number of images.
+        //! \param depth Number of batch buffers, 2 at least.
+        DataLoader(const MNIST::IdxFile &images, const MNIST::IdxFile &labels,
+                   unsigned int classes, unsigned int batch_size, unsigned int epochs,
+                   const Sampler &sampler, unsigned int depth = 2)
+            :images(images), labels(labels), batch_size(batch_size), epochs(epochs),
+             valid_labels(MNIST::labels_below(labels, classes)), sampler(sampler),
+             buffers(std::max(depth, 2u)),
+             current(nullptr), finished(false), stop(false)
+        {
+            for (auto &b : buffers)
+            {
+                b.inputs.resize(images.item_size(), batch_size, false);
+                b.outputs.resize(classes, batch_size, false);
+                spare.push_back(&b);
+            }
+            ready.reserve(buffers.size());
+            thread = std::thread(&DataLoader::produce, this);
+        };
+
+        ~DataLoader()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            emptied.notify_all();
+            thread.join();
+        };
+
+        DataLoader(const DataLoader &) = delete;
+        DataLoader &operator= (const DataLoader &) = delete;
+
+        //! Number of batches of each epoch.
+        unsigned int batch_count() const
+        {
+            if (batch_size == 0 || !valid_labels || labels.count() != images.count()
+                || sampler.size() != images.count())
+                return 0;
+            return sampler.size() / batch_size;
+        };
+
+        //! Wait for the next batch. It stays valid until the next call,
+        //! which gives its buffer back to the loader.
+        //! \return nullptr once all the epochs have been produced.
+        const Batch *next()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (current)
+            {
+                spare.push_back(current);
+                current = nullptr;
+                emptied.notify_one();
+            }
+            filled.wait(lock, [this]() {return !ready.empty() || finished;});
+            if (ready.empty())
+                return nullptr;
+            current = ready.front();
+            ready.erase(ready.begin());
+            return current;
+        }
+
+    private:
+        void produce()
+        {
+            const unsigned int count = batch_count();
+            std::vector<unsigned int> indices;
+
+            for (unsigned int e = 0; e < epochs && count; e++)
+            {
+                sampler.sample(e, indices);
+                for (unsigned int b = 0; b < count; b++)
+                {
+                    Batch *batch;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        emptied.wait(lock, [this]() {return stop || !spare.empty();});
+                        if (stop)
+                            return;
+                        batch = spare.back();
+                        spare.pop_back();
+                    }
+
+                    // Filled without the lock, the buffer being owned
+                    // by this thread until it is pushed to ready.
+                    const unsigned int *first = &indices[b * batch_size];
+                    MNIST::images_to_batch(images, first, batch->inputs);
+                    MNIST::labels_to_batch(labels, first, batch->outputs);
+                    batch->epoch = e;
+
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        ready.push_back(batch);
+                    }
+                    filled.notify_one();
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished = true;
+            }
+            filled.notify_one();
+        }
+
+        const MNIST::IdxFile &images;
+        const MNIST::IdxFile &labels;
+        const unsigned int batch_size;
+        const unsigned int epochs;
+        //! Every label is below the number of classes.
+        const bool valid_labels;
+        //! Only used by the loader thread.
+        Sampler sampler;
+
+        std::vector<Batch> buffers;
+        std::thread thread;
+        std::mutex mutex;
+        //! Signaled when a batch is pushed to ready, or at the end.
+        std::condition_variable filled;
+        //! Signaled when a buffer is given back, or on destruction.
+        std::condition_variable emptied;
+
+        // All of the following are protected by mutex.
+        //! Buffers available to the loader thread.
+        std::vector<Batch *> spare;
+        //! Filled batches, oldest first.
+        std::vector<Batch *> ready;
+        //! Batch owned by the caller of next().
+        Batch *current;
+        //! True once the last batch has been pushed to ready.
+        bool finished;
+        bool stop;
+    };
+}
+
+#endif /* !DATALOADER_HPP_ */
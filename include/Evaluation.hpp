@@ -0,0 +1,64 @@
+#ifndef EVALUATION_HPP_
+#define EVALUATION_HPP_
+
+#include <cstdint>
+
+#include <boost/numeric/ublas/matrix.hpp>
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * Results of the evaluation of a network over a set of samples,
+     * filled by Network::evaluate.
+     *
+     * The class of a sample is the index of the largest value of its
+     * expected output (a one-hot label), and the prediction the one
+     * of the largest output of the network, the first one on ties.
+     */
+    struct Evaluation
+    {
+        //! \param classes The size of the outputs.
+        explicit Evaluation(unsigned int classes = 0)
+            :samples(0), correct(0), loss(0), confusion(classes, classes, 0)
+        {};
+
+        //! Forget the samples, keeping the number of classes.
+        void clear()
+        {
+            samples = correct = 0;
+            loss = 0;
+            confusion.clear();
+        }
+
+        //! Fraction of the samples predicted right.
+        double accuracy() const {return samples ? double(correct) / samples : 0;};
+        //! The cost used by Network::train, 1/2 |output - expected|^2,
+        //! averaged over the samples.
+        double mean_loss() const {return samples ? loss / samples : 0;};
+
+        //! Add the samples of other, which has the same classes.
+        Evaluation &operator+= (const Evaluation &other)
+        {
+            samples += other.samples;
+            correct += other.correct;
+            loss += other.loss;
+            if (confusion.size1() == 0)
+                confusion = other.confusion;
+            else
+                confusion += other.confusion;
+            return *this;
+        }
+
+        std::uint64_t samples;
+        std::uint64_t correct;
+        //! The cost summed over the samples.
+        double loss;
+        //! confusion(expected, predicted) is the number of samples of
+        //! the class expected predicted as predicted.
+        matrix<std::uint64_t> confusion;
+    };
+}
+
+#endif /* !EVALUATION_HPP_ */
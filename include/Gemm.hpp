@@ -0,0 +1,338 @@
+#ifndef GEMM_HPP_
+#define GEMM_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+/**
+ * This file implement the matrix products used by Layer and
+ * Network, on row major T arrays.
+ *
+ * gemv and gemv_trans compute y = A x and y = trans(A) x, both
+ * walking A row by row, several rows at a time so that each load
+ * of x or y serves several rows.
+ *
+ * multiply computes C = A B for strided A and B, which covers the
+ * transposed products without copying. It works on blocks of A
+ * and B small enough to stay in the caches, packed into
+ * contiguous panels in the order the micro-kernel reads them, the
+ * micro-kernel accumulating a mr x nr tile of C in registers.
+ *
+ * The rows of the tile are as wide as the vector registers the
+ * compiler targets (SSE2, AVX or AVX-512). For float and double
+ * they are written with the GCC/Clang vector extensions: left to
+ * the auto-vectorizer, the same loops are sometimes vectorized
+ * along the depth instead, an order of magnitude slower.
+ *
+ * The _sparse versions take a sparse right hand side, in the
+ * compressed storage of uBLAS, and only touch the columns of A
+ * matching its nonzeros.
+ */
+
+namespace ffnn
+{
+namespace gemm
+{
+    //! Size of the vector registers, and rows of the tile of C
+    //! computed by the micro-kernel.
+#if defined(__AVX512F__)
+    const unsigned int register_size = 64;
+    const unsigned int mr = 8;
+#elif defined(__AVX__)
+    const unsigned int register_size = 32;
+    const unsigned int mr = 6;
+#else
+    const unsigned int register_size = 16;
+    const unsigned int mr = 6;
+#endif
+    //! Columns of the tile of C, one register of T.
+    template<typename T>
+    constexpr unsigned int nr()
+    {
+        return register_size / sizeof(T) > 0 ? register_size / sizeof(T) : 1;
+    }
+    //! Rows of A, depth, and columns of B of a packed block.
+    const unsigned int mc = 128;
+    const unsigned int kc = 256;
+    const unsigned int nc = 2048;
+
+    //! A matrix, of which the element (i, j) is data[i * rs + j * cs].
+    template<typename T>
+    struct View
+    {
+        View(const T *data, std::ptrdiff_t rs, std::ptrdiff_t cs)
+            :data(data), rs(rs), cs(cs)
+        {};
+
+        const T &operator() (std::size_t i, std::size_t j) const
+        {return data[i * rs + j * cs];};
+        //! The transposed matrix.
+        View trans() const {return View(data, cs, rs);};
+
+        const T *data;
+        std::ptrdiff_t rs;
+        std::ptrdiff_t cs;
+    };
+
+    //! View of a row major matrix with the given number of columns.
+    template<typename T>
+    View<T> row_major(const T *data, std::size_t cols)
+    {
+        return View<T>(data, cols, 1);
+    }
+
+    namespace detail
+    {
+        //! Dot products of count rows of A (count <= 4) with x,
+        //! converted to and summed as Y. Floating point rows are summed in independent
+        //! lanes, so that the inner loop can be vectorized without
+        //! reordering the additions of a lane; integer additions can
+        //! be reordered by the compiler.
+        template<unsigned int count, typename T, typename X, typename Y>
+        void dot_rows(std::size_t cols, const T *a, const X *x, Y *y)
+        {
+            const unsigned int lanes = std::is_integral<Y>::value ? 1 : 8;
+            Y s[count][lanes] = {};
+            // Bounds computed by division, which can't wrap around
+            // whatever cols is.
+            const std::size_t blocked = cols / lanes * lanes;
+            std::size_t j = 0;
+            for (; j < blocked; j += lanes)
+                for (unsigned int r = 0; r < count; r++)
+                    for (unsigned int t = 0; t < lanes; t++)
+                        s[r][t] += Y(a[r * cols + j + t]) * Y(x[j + t]);
+            for (unsigned int r = 0; r < count; r++)
+            {
+                Y sum = 0;
+                for (unsigned int t = 0; t < lanes; t++)
+                    sum += s[r][t];
+                for (std::size_t k = blocked; k < cols; k++)
+                    sum += Y(a[r * cols + k]) * Y(x[k]);
+                y[r] = sum;
+            }
+        }
+
+        //! Pack the block rows [i0, i0 + m) x columns [p0, p0 + k)
+        //! of a as panels of mr rows, column after column, the last
+        //! panel being padded with zeros.
+        template<typename T>
+        void pack_a(const View<T> &a, std::size_t i0, std::size_t p0,
+                    std::size_t m, std::size_t k, T *buffer)
+        {
+            for (std::size_t ir = 0; ir < m; ir += mr)
+                for (std::size_t p = 0; p < k; p++)
+                    for (unsigned int i = 0; i < mr; i++)
+                        *buffer++ = ir + i < m ? a(i0 + ir + i, p0 + p) : T(0);
+        }
+
+        //! Pack the block rows [p0, p0 + k) x columns [j0, j0 + n)
+        //! of b as panels of nr columns, row after row, the last
+        //! panel being padded with zeros.
+        template<typename T>
+        void pack_b(const View<T> &b, std::size_t p0, std::size_t j0,
+                    std::size_t k, std::size_t n, T *buffer)
+        {
+            const unsigned int nr = gemm::nr<T>();
+            for (std::size_t jr = 0; jr < n; jr += nr)
+                for (std::size_t p = 0; p < k; p++)
+                    for (unsigned int j = 0; j < nr; j++)
+                        *buffer++ = jr + j < n ? b(p0 + p, j0 + jr + j) : T(0);
+        }
+
+        //! Add the product of a panel of A and a panel of B to the
+        //! m x n (at most mr x nr) tile of C at c.
+        template<typename T>
+        void kernel(std::size_t k, const T *a, const T *b, T *c, std::ptrdiff_t ldc,
+                    unsigned int m, unsigned int n, std::false_type)
+        {
+            const unsigned int nr = gemm::nr<T>();
+            T acc[mr][nr] = {};
+            for (std::size_t p = 0; p < k; p++, a += mr, b += nr)
+                for (unsigned int i = 0; i < mr; i++)
+                    for (unsigned int j = 0; j < nr; j++)
+                        acc[i][j] += a[i] * b[j];
+            for (unsigned int i = 0; i < m; i++)
+                for (unsigned int j = 0; j < n; j++)
+                    c[i * ldc + j] += acc[i][j];
+        }
+
+#if defined(__GNUC__)
+        //! Same as above, each row of the tile being one register.
+        template<typename T>
+        void kernel(std::size_t k, const T *a, const T *b, T *c, std::ptrdiff_t ldc,
+                    unsigned int m, unsigned int n, std::true_type)
+        {
+            const unsigned int nr = gemm::nr<T>();
+            typedef T row __attribute__((vector_size(sizeof(T) * nr)));
+            row acc[mr];
+            for (unsigned int i = 0; i < mr; i++)
+                acc[i] = row{};
+            for (std::size_t p = 0; p < k; p++, a += mr, b += nr)
+            {
+                row bp;
+                std::memcpy(&bp, b, sizeof(bp));
+                for (unsigned int i = 0; i < mr; i++)
+                    acc[i] += a[i] * bp;
+            }
+            for (unsigned int i = 0; i < m; i++)
+                for (unsigned int j = 0; j < n; j++)
+                    c[i * ldc + j] += acc[i][j];
+        }
+
+        template<typename T>
+        struct vectorizable
+            :std::integral_constant<bool, std::is_same<T, float>::value
+                                          || std::is_same<T, double>::value>
+        {};
+#else
+        template<typename T>
+        struct vectorizable : std::false_type {};
+#endif
+
+        //! Packing buffers, one pair per thread, which only grow.
+        template<typename T>
+        T *buffer(unsigned int which, std::size_t size)
+        {
+            static thread_local std::vector<T> buffers[2];
+            if (buffers[which].size() < size)
+                buffers[which].resize(size);
+            return buffers[which].data();
+        }
+    }
+
+    //! y = A x, A being a rows x cols row major array. The
+    //! products are computed and summed as Y, such as int32 for
+    //! int8 A and x, or float for half A and float x.
+    template<typename T, typename X, typename Y>
+    void gemv(std::size_t rows, std::size_t cols, const T *a, const X *x, Y *y)
+    {
+        const std::size_t blocked = rows / 4 * 4;
+        for (std::size_t i = 0; i < blocked; i += 4)
+            detail::dot_rows<4>(cols, a + i * cols, x, y + i);
+        for (std::size_t i = blocked; i < rows; i++)
+            detail::dot_rows<1>(cols, a + i * cols, x, y + i);
+    }
+
+    //! y = trans(A) x, A being a rows x cols row major array.
+    //! A is read row by row, each row being added to y.
+    template<typename T>
+    void gemv_trans(std::size_t rows, std::size_t cols, const T *a, const T *x, T *y)
+    {
+        std::fill(y, y + cols, T(0));
+        const std::size_t blocked = rows / 4 * 4;
+        for (std::size_t i = 0; i < blocked; i += 4)
+        {
+            const T *a0 = a + i * cols, *a1 = a0 + cols, *a2 = a1 + cols, *a3 = a2 + cols;
+            const T x0 = x[i], x1 = x[i + 1], x2 = x[i + 2], x3 = x[i + 3];
+            for (std::size_t j = 0; j < cols; j++)
+                y[j] += x0 * a0[j] + x1 * a1[j] + x2 * a2[j] + x3 * a3[j];
+        }
+        for (std::size_t i = blocked; i < rows; i++)
+        {
+            const T *ai = a + i * cols;
+            const T xi = x[i];
+            for (std::size_t j = 0; j < cols; j++)
+                y[j] += xi * ai[j];
+        }
+    }
+
+    //! C = A B, A being m x k, B k x n and C m x n, row major with
+    //! ldc elements per row. Doesn't allocate once the packing
+    //! buffers of the calling thread are big enough.
+    template<typename T>
+    void multiply(std::size_t m, std::size_t n, std::size_t k,
+                  const View<T> &a, const View<T> &b, T *c, std::ptrdiff_t ldc)
+    {
+        for (std::size_t i = 0; i < m; i++)
+            std::fill(c + i * ldc, c + i * ldc + n, T(0));
+        if (k == 0)
+            return;
+
+        const unsigned int nr = gemm::nr<T>();
+        const std::size_t n_block = std::min<std::size_t>(n, nc);
+        const std::size_t k_block = std::min<std::size_t>(k, kc);
+        const std::size_t m_block = std::min<std::size_t>(m, mc);
+        T *packed_a = detail::buffer<T>(0, (m_block + mr - 1) / mr * mr * k_block);
+        T *packed_b = detail::buffer<T>(1, (n_block + nr - 1) / nr * nr * k_block);
+
+        for (std::size_t jc = 0; jc < n; jc += nc)
+        {
+            const std::size_t nb = std::min<std::size_t>(nc, n - jc);
+            for (std::size_t pc = 0; pc < k; pc += kc)
+            {
+                const std::size_t kb = std::min<std::size_t>(kc, k - pc);
+                detail::pack_b(b, pc, jc, kb, nb, packed_b);
+                for (std::size_t ic = 0; ic < m; ic += mc)
+                {
+                    const std::size_t mb = std::min<std::size_t>(mc, m - ic);
+                    detail::pack_a(a, ic, pc, mb, kb, packed_a);
+                    for (std::size_t jr = 0; jr < nb; jr += nr)
+                        for (std::size_t ir = 0; ir < mb; ir += mr)
+                            detail::kernel(kb, packed_a + ir * kb, packed_b + jr * kb,
+                                           c + (ic + ir) * ldc + jc + jr, ldc,
+                                           std::min<std::size_t>(mr, mb - ir),
+                                           std::min<std::size_t>(nr, nb - jr),
+                                           detail::vectorizable<T>());
+                }
+            }
+        }
+    }
+
+    //! y = A x, A being a rows x cols row major array and x a
+    //! sparse vector of nnz values at the sorted positions index.
+    //! Only the columns of A matching the nonzeros are read.
+    template<typename T, typename I>
+    void gemv_sparse(std::size_t rows, std::size_t cols, const T *a,
+                     std::size_t nnz, const I *index, const T *values, T *y)
+    {
+        for (std::size_t i = 0; i < rows; i++, a += cols)
+        {
+            T sum = 0;
+            for (std::size_t k = 0; k < nnz; k++)
+                sum += a[index[k]] * values[k];
+            y[i] = sum;
+        }
+    }
+
+    //! C = A X, A being m x k row major and X a k x n compressed
+    //! column matrix: the nonzeros of column j are values[p] at rows
+    //! index[p], for p in [starts[j], starts[j + 1]).
+    template<typename T, typename I>
+    void multiply_sparse(std::size_t m, std::size_t n, std::size_t k, const T *a,
+                         const I *starts, const I *index, const T *values,
+                         T *c, std::ptrdiff_t ldc)
+    {
+        for (std::size_t i = 0; i < m; i++, a += k, c += ldc)
+            for (std::size_t j = 0; j < n; j++)
+            {
+                T sum = 0;
+                for (I p = starts[j]; p < starts[j + 1]; p++)
+                    sum += a[index[p]] * values[p];
+                c[j] = sum;
+            }
+    }
+
+    //! A += alpha * D trans(X), A being m x k row major, D m x n
+    //! row major with ldd elements per row, and X a k x n compressed
+    //! column matrix as in multiply_sparse. Only the columns of A
+    //! matching the nonzeros of X are written.
+    template<typename T, typename I>
+    void add_product_sparse(std::size_t m, std::size_t n, std::size_t k, T alpha,
+                            const T *d, std::ptrdiff_t ldd, const I *starts,
+                            const I *index, const T *values, T *a)
+    {
+        for (std::size_t i = 0; i < m; i++, a += k, d += ldd)
+            for (std::size_t j = 0; j < n; j++)
+            {
+                const T scale = alpha * d[j];
+                for (I p = starts[j]; p < starts[j + 1]; p++)
+                    a[index[p]] += scale * values[p];
+            }
+    }
+}
+}
+
+#endif /* !GEMM_HPP_ */
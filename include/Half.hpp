@@ -0,0 +1,129 @@
+#ifndef HALF_HPP_
+#define HALF_HPP_
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+/**
+ * This file implement 16 bits floating point types, used to store
+ * weights in half the memory of a float. They only convert from
+ * and to float, any computation being done in float.
+ *
+ * half is the IEEE 754 binary16 format: 11 bits of precision,
+ * values up to 65504. bfloat16 is the upper half of a float: the
+ * range of a float, with 8 bits of precision. Both round to the
+ * nearest, ties to even.
+ */
+
+namespace ffnn
+{
+    namespace detail
+    {
+        inline std::uint32_t float_bits(float f)
+        {
+            std::uint32_t x;
+            std::memcpy(&x, &f, sizeof(x));
+            return x;
+        }
+
+        inline float bits_float(std::uint32_t x)
+        {
+            float f;
+            std::memcpy(&f, &x, sizeof(f));
+            return f;
+        }
+    }
+
+    struct half
+    {
+        half() = default;
+        explicit half(float f) :bits(from_float(f)) {};
+        operator float() const {return to_float(bits);};
+
+        static std::uint16_t from_float(float f)
+        {
+#if defined(__F16C__)
+            return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+            const std::uint32_t f32_infinity = 255u << 23;
+            const std::uint32_t f16_overflow = (127u + 16) << 23;
+            const std::uint32_t denormal_magic = ((127u - 15) + (23 - 10) + 1) << 23;
+
+            std::uint32_t x = detail::float_bits(f);
+            const std::uint32_t sign = x & 0x80000000u;
+            x ^= sign;
+
+            std::uint16_t h;
+            if (x >= f16_overflow)
+                h = x > f32_infinity ? 0x7e00 : 0x7c00; // nan or inf
+            else if (x < (113u << 23))
+            {
+                // Denormal or zero: the addition rounds the mantissa
+                // at the right position.
+                float d = detail::bits_float(x) + detail::bits_float(denormal_magic);
+                h = detail::float_bits(d) - denormal_magic;
+            }
+            else
+            {
+                const std::uint32_t odd = (x >> 13) & 1;
+                x += ((15u - 127) << 23) + 0xfff + odd;
+                h = x >> 13;
+            }
+            return h | (sign >> 16);
+#endif
+        }
+
+        static float to_float(std::uint16_t h)
+        {
+#if defined(__F16C__)
+            return _cvtsh_ss(h);
+#else
+            // Without branches, so that converting an array can be
+            // vectorized.
+            const std::uint32_t exponent_mask = 0x7c00u << 13;
+            std::uint32_t x = (h & 0x7fffu) << 13;
+            const std::uint32_t exponent = x & exponent_mask;
+            x += (127u - 15) << 23;
+            const std::uint32_t special = 0u - (exponent == exponent_mask);
+            x += special & ((128u - 16) << 23); // nan or inf
+            // Denormal or zero, renormalized by a subtraction.
+            const std::uint32_t denormal = 0u - (exponent == 0);
+            const std::uint32_t renormalized = detail::float_bits(detail::bits_float(x + (1u << 23))
+                                                                  - detail::bits_float(113u << 23));
+            x = (renormalized & denormal) | (x & ~denormal);
+            return detail::bits_float(x | (std::uint32_t(h & 0x8000u) << 16));
+#endif
+        }
+
+        std::uint16_t bits;
+    };
+
+    struct bfloat16
+    {
+        bfloat16() = default;
+        explicit bfloat16(float f) :bits(from_float(f)) {};
+        operator float() const {return to_float(bits);};
+
+        static std::uint16_t from_float(float f)
+        {
+            std::uint32_t x = detail::float_bits(f);
+            if ((x & 0x7fffffffu) > 0x7f800000u)
+                return (x >> 16) | 0x40; // keep nan quiet
+            x += 0x7fff + ((x >> 16) & 1);
+            return x >> 16;
+        }
+
+        static float to_float(std::uint16_t b)
+        {
+            return detail::bits_float(std::uint32_t(b) << 16);
+        }
+
+        std::uint16_t bits;
+    };
+}
+
+#endif /* !HALF_HPP_ */
@@ -0,0 +1,292 @@
+#ifndef INFERENCESERVER_HPP_
+#define INFERENCESERVER_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Network.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * Evaluate a Network for many client threads, each submitting
+     * one input at a time.
+     *
+     * The requests are queued and coalesced into batches of up to
+     * max_batch inputs, which a fixed set of worker threads run
+     * through Network::forward_batch. An idle worker waits for the
+     * queue to hold a full batch, or for the oldest request to have
+     * waited max_delay, whichever comes first: under load the
+     * batches are full, and a lone request waits max_delay at most
+     * before being evaluated.
+     *
+     * The network is shared by the workers and only read, it must
+     * not be modified while the server runs.
+     */
+    template<typename T>
+    class InferenceServer
+    {
+    public:
+        typedef std::chrono::steady_clock clock;
+
+        //! Latency and throughput since the start, or the last
+        //! reset_stats(). The latency of a request is the time from
+        //! submit() to its result being available.
+        struct Stats
+        {
+            std::uint64_t requests;
+            std::uint64_t batches;
+            //! Seconds covered by the stats.
+            double elapsed;
+            //! Requests per second.
+            double throughput;
+            double mean_batch;
+            //! Latencies, in microseconds, within about 6%.
+            double p50;
+            double p99;
+            double max;
+        };
+
+        //! Start the workers.
+        //! \param net The network evaluated, which must outlive the server.
+        //! \param workers Number of worker threads, 0 means one per core.
+        //! \param max_batch Largest number of requests evaluated together.
+        //! \param max_delay Longest time a request waits for others
+        //!                  to fill a batch.
+        InferenceServer(const Network<T> &net, unsigned int workers = 0,
+                        unsigned int max_batch = 32,
+                        clock::duration max_delay = std::chrono::microseconds(500))
+            :net(net), max_batch(std::max(max_batch, 1u)), max_delay(max_delay), stop(false)
+        {
+            reset_stats();
+            if (workers == 0)
+                workers = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned int i = 0; i < workers; i++)
+                threads.push_back(std::thread(&InferenceServer::work, this));
+        };
+
+        //! Evaluate the requests still queued, then stop the workers.
+        ~InferenceServer()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            ready.notify_all();
+            for (auto &t : threads)
+                t.join();
+        };
+
+        InferenceServer(const InferenceServer &) = delete;
+        InferenceServer &operator= (const InferenceServer &) = delete;
+
+        //! Queue input for evaluation. Can be called from any thread.
+        //! \return The future output of the network, an empty vector
+        //!         if input doesn't have the input size of the network.
+        std::future<vector<T>> submit(vector<T> input)
+        {
+            Request request;
+            request.input.swap(input);
+            request.arrival = clock::now();
+            std::future<vector<T>> result = request.result.get_future();
+            const auto &layers = net.get_layers();
+            if (layers.empty() || request.input.size() != layers.front().get_input_size())
+            {
+                request.result.set_value(vector<T>());
+                return result;
+            }
+
+            std::size_t size;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.push_back(std::move(request));
+                size = queue.size();
+            }
+            // Starts the deadline of a batch, or completes it.
+            if (size == 1 || size == max_batch)
+                ready.notify_all();
+            return result;
+        }
+
+        //! Same as submit(input).get().
+        vector<T> eval(const vector<T> &input)
+        {
+            return submit(input).get();
+        }
+
+        Stats stats() const
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            Stats s;
+            s.requests = requests;
+            s.batches = batches;
+            s.elapsed = std::chrono::duration<double>(clock::now() - stats_start).count();
+            s.throughput = s.elapsed > 0 ? requests / s.elapsed : 0;
+            s.mean_batch = batches ? double(requests) / batches : 0;
+            s.p50 = percentile(0.5);
+            s.p99 = percentile(0.99);
+            s.max = max_latency;
+            return s;
+        }
+
+        void reset_stats()
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            std::fill(histogram, histogram + bucket_count, 0);
+            requests = batches = 0;
+            max_latency = 0;
+            stats_start = clock::now();
+        }
+
+    private:
+        struct Request
+        {
+            vector<T> input;
+            std::promise<vector<T>> result;
+            clock::time_point arrival;
+        };
+
+        void work()
+        {
+            Workspace<T> ws;
+            matrix<T> inputs;
+            std::vector<Request> batch;
+            batch.reserve(max_batch);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                ready.wait(lock, [this]() {return stop || !queue.empty();});
+                if (queue.empty())
+                    return;
+                const clock::time_point deadline = queue.front().arrival + max_delay;
+                ready.wait_until(lock, deadline, [this]() {
+                        return stop || queue.size() >= max_batch;
+                    });
+                // Another worker can have taken the requests meanwhile.
+                if (queue.empty())
+                    continue;
+
+                const std::size_t n = std::min<std::size_t>(queue.size(), max_batch);
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+                if (!queue.empty())
+                    ready.notify_all();
+                lock.unlock();
+
+                evaluate(ws, inputs, batch);
+                batch.clear();
+
+                lock.lock();
+            }
+        }
+
+        //! Evaluate the requests of batch and fulfill their promises.
+        void evaluate(Workspace<T> &ws, matrix<T> &inputs, std::vector<Request> &batch)
+        {
+            const unsigned int n = batch.size();
+            if (n == 1)
+                batch[0].result.set_value(net.eval(ws, batch[0].input));
+            else
+            {
+                const unsigned int size = batch[0].input.size();
+                if (inputs.size1() != size || inputs.size2() != n)
+                    inputs.resize(size, n, false);
+                for (unsigned int j = 0; j < n; j++)
+                    noalias(column(inputs, j)) = batch[j].input;
+                net.forward_batch(ws, inputs);
+                const matrix<T> &outputs = ws.batch_activations.back();
+                for (unsigned int j = 0; j < n; j++)
+                    batch[j].result.set_value(vector<T>(column(outputs, j)));
+            }
+
+            const clock::time_point now = clock::now();
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            batches++;
+            requests += n;
+            for (const auto &r : batch)
+            {
+                const std::uint64_t us =
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - r.arrival).count();
+                histogram[bucket(us)]++;
+                max_latency = std::max(max_latency, double(us));
+            }
+        }
+
+        //! The latencies are counted in buckets of 16 per power of 2,
+        //! exact below 16 us.
+        static const unsigned int bucket_count = 16 * 61;
+
+        static unsigned int bucket(std::uint64_t us)
+        {
+            if (us < 16)
+                return us;
+            unsigned int e = 4;
+            while (e < 63 && (us >> (e + 1)))
+                e++;
+            return (e - 3) * 16 + ((us >> (e - 4)) & 15);
+        }
+
+        //! Middle of the range of latencies of bucket b.
+        static double bucket_value(unsigned int b)
+        {
+            if (b < 16)
+                return b;
+            const unsigned int e = b / 16 + 3;
+            const double low = double(16 + b % 16) * double(std::uint64_t(1) << (e - 4));
+            return low + double(std::uint64_t(1) << (e - 4)) / 2;
+        }
+
+        //! Latency below which are the fraction p of the requests.
+        //! Called with stats_mutex held.
+        double percentile(double p) const
+        {
+            if (requests == 0)
+                return 0;
+            const std::uint64_t rank = std::max<std::uint64_t>(1, std::ceil(p * requests));
+            std::uint64_t seen = 0;
+            for (unsigned int b = 0; b < bucket_count; b++)
+            {
+                seen += histogram[b];
+                if (seen >= rank)
+                    return std::min(bucket_value(b), max_latency);
+            }
+            return max_latency;
+        }
+
+        const Network<T> &net;
+        const unsigned int max_batch;
+        const clock::duration max_delay;
+        std::vector<std::thread> threads;
+
+        std::mutex mutex;
+        //! Signaled when a batch can be started, or on destruction.
+        std::condition_variable ready;
+        // Protected by mutex.
+        std::deque<Request> queue;
+        bool stop;
+
+        mutable std::mutex stats_mutex;
+        // Protected by stats_mutex.
+        std::uint64_t histogram[bucket_count];
+        std::uint64_t requests;
+        std::uint64_t batches;
+        double max_latency;
+        clock::time_point stats_start;
+    };
+}
+
+#endif /* !INFERENCESERVER_HPP_ */
@@ -0,0 +1,409 @@
+#ifndef JSONSTREAM_HPP_
+#define JSONSTREAM_HPP_
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * This file implement a streaming JSON writer and reader, used
+ * by Layer and Network to save and load models without building
+ * a boost::property_tree first. Values are written or read one
+ * at a time, so the memory used doesn't depend on the size of
+ * the document, and numbers are parsed straight into the
+ * destination.
+ *
+ * Numbers are written with the shortest representation that
+ * reads back to the same value. They can be read from either a
+ * JSON number or a string, since property_tree writes every
+ * value as a string.
+ */
+
+namespace ffnn
+{
+namespace json
+{
+    //! Parse a number, with the correct rounding for T.
+    inline bool parse_number(const char *s, float &v)
+    {
+        char *end;
+        v = std::strtof(s, &end);
+        return end != s && *end == '\0';
+    }
+    inline bool parse_number(const char *s, double &v)
+    {
+        char *end;
+        v = std::strtod(s, &end);
+        return end != s && *end == '\0';
+    }
+    inline bool parse_number(const char *s, long double &v)
+    {
+        char *end;
+        v = std::strtold(s, &end);
+        return end != s && *end == '\0';
+    }
+    inline bool parse_number(const char *s, unsigned int &v)
+    {
+        char *end;
+        unsigned long l = std::strtoul(s, &end, 10);
+        v = l;
+        return end != s && *end == '\0' && *s != '-'
+            && l <= std::numeric_limits<unsigned int>::max();
+    }
+
+    class Writer
+    {
+    public:
+        explicit Writer(std::ostream &os)
+            :os(os), after_key(false)
+        {};
+
+        void begin_object()
+        {
+            begin_value(true);
+            os << '{';
+            levels.push_back(Level());
+        }
+
+        void end_object()
+        {
+            end_container();
+            os << '}';
+        }
+
+        void begin_array()
+        {
+            begin_value(true);
+            os << '[';
+            levels.push_back(Level());
+        }
+
+        void end_array()
+        {
+            end_container();
+            os << ']';
+        }
+
+        //! Write the key of the next member of the current object.
+        void key(const char *name)
+        {
+            separate(true);
+            write_string(name);
+            os << ": ";
+            after_key = true;
+        }
+
+        void value(const char *s)
+        {
+            begin_value(false);
+            write_string(s);
+        }
+
+        //! Write an integer, with all its digits.
+        template<typename T>
+        typename std::enable_if<std::is_integral<T>::value>::type value(T v)
+        {
+            begin_value(false);
+            os << +v;
+        }
+
+        //! Write a floating point value, with the shortest
+        //! representation that reads back to v.
+        template<typename T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type value(T v)
+        {
+            begin_value(false);
+            char buffer[64];
+            format(v, buffer, sizeof(buffer));
+            if (v != v || v - v != 0)
+                write_string(buffer); // nan and inf aren't JSON numbers
+            else
+                os << buffer;
+        }
+
+        //! Write the shortest representation of v reading back to v.
+        template<typename T>
+        static void format(T v, char *buffer, std::size_t size)
+        {
+            static_assert(std::is_floating_point<T>::value, "format is for floating point values");
+            for (int p = std::numeric_limits<T>::digits10;
+                 p < std::numeric_limits<T>::max_digits10; p++)
+            {
+                std::snprintf(buffer, size, "%.*Lg", p, static_cast<long double>(v));
+                T r;
+                if (parse_number(buffer, r) && r == v)
+                    return;
+            }
+            std::snprintf(buffer, size, "%.*Lg", std::numeric_limits<T>::max_digits10,
+                          static_cast<long double>(v));
+        }
+
+    private:
+        struct Level
+        {
+            Level() :first(true), multiline(false) {};
+            //! True until the first element of the container.
+            bool first;
+            //! True if the elements are on their own lines.
+            bool multiline;
+        };
+
+        //! Called before any value. Members of objects and containers
+        //! inside arrays are put on their own line, the other values
+        //! on the same one.
+        void begin_value(bool container)
+        {
+            if (after_key)
+            {
+                after_key = false;
+                return;
+            }
+            if (!levels.empty())
+                separate(container);
+        }
+
+        void separate(bool newline)
+        {
+            Level &level = levels.back();
+            if (!level.first)
+                os << ',';
+            if (newline)
+            {
+                level.multiline = true;
+                indent(levels.size());
+            }
+            else if (!level.first)
+                os << ' ';
+            level.first = false;
+        }
+
+        void end_container()
+        {
+            bool multiline = levels.back().multiline;
+            levels.pop_back();
+            if (multiline)
+                indent(levels.size());
+        }
+
+        void indent(std::size_t depth)
+        {
+            os << '\n';
+            for (std::size_t i = 0; i < depth; i++)
+                os << "    ";
+        }
+
+        void write_string(const char *s)
+        {
+            os << '"';
+            for (; *s; s++)
+            {
+                if (*s == '"' || *s == '\\')
+                    os << '\\';
+                os << *s;
+            }
+            os << '"';
+        }
+
+        std::ostream &os;
+        //! One level per open container.
+        std::vector<Level> levels;
+        //! True between a key and its value.
+        bool after_key;
+    };
+
+    class Reader
+    {
+    public:
+        explicit Reader(std::istream &is)
+            :sb(is.rdbuf()), first(false), error(false)
+        {};
+
+        //! False once a syntax error has been found.
+        bool good() const {return !error;};
+
+        //! Read '{'.
+        bool begin_object() {return begin('{');};
+
+        //! Read the key of the next member of the current object.
+        //! \return false at the end of the object, or on error.
+        bool next_key(std::string &key)
+        {
+            if (!next('}'))
+                return false;
+            if (!read_string(key) || !expect(':'))
+                return false;
+            return true;
+        }
+
+        //! Read '['.
+        bool begin_array() {return begin('[');};
+
+        //! Move to the next element of the current array.
+        //! \return false at the end of the array, or on error.
+        bool next_element() {return next(']');};
+
+        bool read_string(std::string &s)
+        {
+            skip_ws();
+            if (!expect('"'))
+                return false;
+            s.clear();
+            for (;;)
+            {
+                int c = sb->sbumpc();
+                if (c == EOF)
+                    return fail();
+                if (c == '"')
+                    return true;
+                if (c == '\\')
+                {
+                    c = sb->sbumpc();
+                    switch (c)
+                    {
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 't': c = '\t'; break;
+                    case 'u':
+                    {
+                        char hex[5] = {};
+                        for (int i = 0; i < 4; i++)
+                            hex[i] = sb->sbumpc();
+                        c = std::strtol(hex, nullptr, 16);
+                        break;
+                    }
+                    case EOF: return fail();
+                    default: break;
+                    }
+                }
+                s += char(c);
+            }
+        }
+
+        //! Read a number, either as a JSON number or as a string.
+        template<typename T>
+        bool read_number(T &v)
+        {
+            skip_ws();
+            bool quoted = sb->sgetc() == '"';
+            if (quoted)
+                sb->sbumpc();
+            char buffer[64];
+            std::size_t n = 0;
+            for (int c = sb->sgetc(); c != EOF && n + 1 < sizeof(buffer); c = sb->sgetc())
+            {
+                if (!(std::isalnum(c) || c == '-' || c == '+' || c == '.'))
+                    break;
+                buffer[n++] = sb->sbumpc();
+            }
+            buffer[n] = '\0';
+            if (quoted && !expect('"'))
+                return false;
+            if (!parse_number(buffer, v))
+                return fail();
+            return true;
+        }
+
+        //! Read and ignore any value.
+        bool skip_value()
+        {
+            skip_ws();
+            int c = sb->sgetc();
+            std::string s;
+            if (c == '"')
+                return read_string(s);
+            if (c == '{')
+            {
+                begin_object();
+                while (next_key(s))
+                    if (!skip_value())
+                        return false;
+                return good();
+            }
+            if (c == '[')
+            {
+                begin_array();
+                while (next_element())
+                    if (!skip_value())
+                        return false;
+                return good();
+            }
+            // Numbers, true, false and null.
+            first = false;
+            bool any = false;
+            for (c = sb->sgetc(); c != EOF && (std::isalnum(c) || c == '-' || c == '+' || c == '.');
+                 c = sb->sgetc())
+            {
+                sb->sbumpc();
+                any = true;
+            }
+            return any || fail();
+        }
+
+    private:
+        bool begin(char open)
+        {
+            skip_ws();
+            if (!expect(open))
+                return false;
+            first = true;
+            return true;
+        }
+
+        //! Handle the separator before an element, or the end of
+        //! the container. A closed container is itself an element,
+        //! so the parent is no longer at its first one.
+        bool next(char close)
+        {
+            skip_ws();
+            if (error)
+                return false;
+            if (sb->sgetc() == close)
+            {
+                sb->sbumpc();
+                first = false;
+                return false;
+            }
+            if (!first && !expect(','))
+                return false;
+            first = false;
+            return true;
+        }
+
+        bool expect(char c)
+        {
+            skip_ws();
+            if (sb->sgetc() != c)
+                return fail();
+            sb->sbumpc();
+            return true;
+        }
+
+        void skip_ws()
+        {
+            for (int c = sb->sgetc(); c == ' ' || c == '\n' || c == '\r' || c == '\t'; c = sb->sgetc())
+                sb->sbumpc();
+        }
+
+        bool fail()
+        {
+            error = true;
+            return false;
+        }
+
+        std::streambuf *sb;
+        //! True right after '{' or '['.
+        bool first;
+        bool error;
+    };
+}
+}
+
+#endif /* !JSONSTREAM_HPP_ */
@@ -5,15 +5,20 @@
 #include <algorithm>
 #include <random>
 #include <cmath>
+#include <type_traits>
 
 #include <boost/numeric/ublas/matrix_sparse.hpp>
 #include <boost/numeric/ublas/vector_sparse.hpp>
+#include <boost/numeric/ublas/matrix_proxy.hpp>
 #include <boost/numeric/ublas/io.hpp>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include "Activation.hpp"
 #include "FMap.hpp"
+#include "Gemm.hpp"
+#include "JsonStream.hpp"
 
 namespace ffnn
 {
@@ -34,34 +39,199 @@ namespace ffnn
         Layer(unsigned int input_size, unsigned int output_size,
               T(*threshold)(T), T(*derivative)(T))
             :weights(output_size, input_size), biases(output_size),
+             activation(ActivationId::custom),
              threshold_function(threshold), derivative_function(derivative)
-        {};
+        {
+            // Use the compile time version when it's known.
+            if (threshold == &sigmoid<T> && derivative == &sigmoid_prime<T>)
+                activation = ActivationId::sigmoid;
+        };
+        //! Slow path, calling threshold and derivative through
+        //! std::function for each element.
         Layer(unsigned int input_size, unsigned int output_size,
               std::function<T(T)> threshold, std::function<T(T)> derivative)
             :weights(output_size, input_size), biases(output_size),
+             activation(ActivationId::custom),
              threshold_function(threshold), derivative_function(derivative)
         {};
+        /**
+         * \param input_size The length of the input vector
+         * \param output_size The number of neurons inside the layer
+         * \param A The activation policy (Sigmoid, Tanh, ReLU,
+         *          Identity or Softmax) from Activation.hpp.
+         */
+        template<typename A>
+        Layer(unsigned int input_size, unsigned int output_size, A)
+            :weights(output_size, input_size), biases(output_size),
+             activation(A::id)
+        {};
+        /**
+         * \param weights The weights, output_size x input_size
+         * \param biases The biases, output_size of them
+         * \param activation One of the activations of Activation.hpp,
+         *                   not custom.
+         */
+        Layer(const matrix<T> &weights, const vector<T> &biases, ActivationId activation)
+            :weights(weights), biases(biases), activation(activation)
+        {};
         Layer()
+            :activation(ActivationId::custom)
         {};
         Layer(const boost::property_tree::ptree &tree)
+            :activation(ActivationId::custom)
         {
             load(tree);
         };
 
         unsigned int get_input_size() const {return weights.size2();};
         unsigned int get_output_size() const {return weights.size1();};
+        ActivationId get_activation() const {return activation;};
+        //! The weights, output_size x input_size.
+        const matrix<T> &get_weights() const {return weights;};
+        const vector<T> &get_biases() const {return biases;};
 
         vector<T> operator<< (const vector<T> &input) const
         {
-            return threshold_function % vector<T>(biases + prod(weights, input));
+            vector<T> output(get_output_size());
+            forward(input, output);
+            return output;
+        }
+
+        //! Batched version of operator<<. Each column of input is a sample,
+        //! and the corresponding column of the result is the layer output.
+        matrix<T> operator<< (const matrix<T> &input) const
+        {
+            matrix<T> output(get_output_size(), input.size2());
+            forward(input, output);
+            return output;
+        }
+
+        //! Same as operator<<, but write the result into output,
+        //! which must already have the right size. Doesn't allocate.
+        void forward(const vector<T> &input, vector<T> &output) const
+        {
+            gemm::gemv(weights.size1(), weights.size2(), weights.data().begin(),
+                       input.data().begin(), output.data().begin());
+            apply_biases_and_threshold(output);
+        }
+
+        //! Batched version of forward().
+        void forward(const matrix<T> &input, matrix<T> &output) const
+        {
+            forward(input.data().begin(), output.data().begin(), input.size2());
+        }
+
+        //! Same as above on row major arrays of batch_size columns,
+        //! input having get_input_size() rows and output
+        //! get_output_size() ones.
+        void forward(const T *input, T *output, unsigned int batch_size) const
+        {
+            gemm::multiply(weights.size1(), batch_size, weights.size2(),
+                           gemm::row_major(weights.data().begin(), weights.size2()),
+                           gemm::row_major(input, batch_size), output, batch_size);
+            apply_biases_and_threshold(output, batch_size);
+        }
+
+        //! Same as forward() for a sparse input, only reading the
+        //! columns of the weights matching its nonzeros.
+        void forward(const compressed_vector<T> &input, vector<T> &output) const
+        {
+            gemm::gemv_sparse(weights.size1(), weights.size2(), weights.data().begin(),
+                              input.nnz(), input.index_data().begin(),
+                              input.value_data().begin(), output.data().begin());
+            apply_biases_and_threshold(output);
+        }
+
+        //! Batched version of the above, one sample per column of input.
+        void forward(const compressed_matrix<T, column_major> &input, matrix<T> &output) const
+        {
+            // The columns from filled1() - 1 on have no nonzero, and
+            // their start isn't stored.
+            const std::size_t filled = input.filled1() - 1;
+            gemm::multiply_sparse(weights.size1(), filled, weights.size2(),
+                                  weights.data().begin(), input.index1_data().begin(),
+                                  input.index2_data().begin(), input.value_data().begin(),
+                                  output.data().begin(), output.size2());
+            for (unsigned int i = 0; i < output.size1(); i++)
+            {
+                T *row = output.data().begin() + i * output.size2();
+                std::fill(row + filled, row + output.size2(), T(0));
+            }
+            apply_biases_and_threshold(output);
+        }
+
+        //! Multiply delta by the derivative of the threshold function
+        //! taken at a = threshold_function(z): element by element, but
+        //! for softmax whose jacobian mixes the outputs.
+        void derivative_mask(vector<T> &delta, const vector<T> &a) const
+        {
+            derivative_mask(delta.data().begin(), a.data().begin(), 1);
+        }
+
+        //! Batched version of derivative_mask().
+        void derivative_mask(matrix<T> &delta, const matrix<T> &a) const
+        {
+            derivative_mask(delta.data().begin(), a.data().begin(), delta.size2());
+        }
+
+        //! Same as above on row major arrays of get_output_size()
+        //! rows and batch_size columns.
+        void derivative_mask(T *delta, const T *a, unsigned int batch_size) const
+        {
+            if (ffnn::derivative_mask(activation, delta, a, get_output_size(), batch_size))
+                return;
+            const std::size_t n = std::size_t(get_output_size()) * batch_size;
+            for (std::size_t i = 0; i < n; i++)
+                delta[i] *= derivative_function(a[i]);
+        }
+
+        //! Compute threshold_function(z + biases) in place.
+        void apply_biases_and_threshold(vector<T> &z) const
+        {
+            if (ffnn::activate(activation, z.data().begin(), biases.data().begin(), z.size(), 1))
+                return;
+            noalias(z) += biases;
+            threshold_function %= z;
+        }
+
+        //! Batched version of apply_biases_and_threshold(), each
+        //! column of z being a sample.
+        void apply_biases_and_threshold(matrix<T> &z) const
+        {
+            apply_biases_and_threshold(z.data().begin(), z.size2());
+        }
+
+        //! Same as above on a row major array of get_output_size()
+        //! rows and batch_size columns.
+        void apply_biases_and_threshold(T *z, unsigned int batch_size) const
+        {
+            if (ffnn::activate(activation, z, biases.data().begin(), biases.size(), batch_size))
+                return;
+            for (unsigned int i = 0; i < biases.size(); i++)
+                for (unsigned int j = 0; j < batch_size; j++)
+                {
+                    T &v = z[std::size_t(i) * batch_size + j];
+                    v = threshold_function(v + biases(i));
+                }
         }
 
         //! Randomize weights and biases with values in [-1, 1].
         void randomize(void)
+        {
+            randomize(eng);
+        }
+
+        //! Same as randomize(), drawing from the given random engine.
+        template<class Engine>
+        void randomize(Engine &engine)
         {
             // Notice this function doesn't work for non-fractional type T.
-            std::uniform_real_distribution<> dis(-1, 1);
-            auto f = [this, &dis](T x) -> T {return dis(eng);};
+            // Values are drawn directly as T when it is a floating point
+            // type, without going through double.
+            typedef typename std::conditional<std::is_floating_point<T>::value,
+                                              T, double>::type real;
+            std::uniform_real_distribution<real> dis(-1, 1);
+            auto f = [&engine, &dis](T x) -> T {return dis(engine);};
             f %= weights;
             f %= biases;
         }
@@ -69,20 +239,28 @@ namespace ffnn
         //! Randomize weights and biases with values in
         //! [0, minstd_rand::max() - minstd_rand::min()].
         void randomize_int(void)
+        {
+            randomize_int(eng);
+        }
+
+        //! Same as randomize_int(), drawing from the given random
+        //! engine, with values in [0, Engine::max() - Engine::min()].
+        template<class Engine>
+        void randomize_int(Engine &engine)
         {
             // Notice this function doesn't work for non-fractional type T.
-            auto f = [this](T x) -> T {return T(eng() - eng.min());};
+            auto f = [&engine](T x) -> T {return T(engine() - engine.min());};
             f %= weights;
             f %= biases;
         }
 
-        boost::property_tree::ptree serialize()
+        boost::property_tree::ptree serialize() const
         {
             namespace pt = boost::property_tree;
 
             pt::ptree root, layer, ts_fct, w, b;
 
-            layer.put("threshold_function", "sigmoid");
+            layer.put("threshold_function", activation_name(activation));
             layer.put("input_size", weights.size2());
             layer.put("output_size", weights.size1());
 
@@ -110,6 +288,38 @@ namespace ffnn
             return layer;
         }
 
+        //! Streaming version of serialize(), writing the layer
+        //! as a JSON object with the same schema.
+        void serialize(json::Writer &w) const
+        {
+            w.begin_object();
+            w.key("threshold_function");
+            w.value(activation_name(activation));
+            w.key("input_size");
+            w.value(get_input_size());
+            w.key("output_size");
+            w.value(get_output_size());
+
+            w.key("weights");
+            w.begin_array();
+            for (unsigned int x = 0; x < weights.size1(); x++)
+            {
+                w.begin_array();
+                for (unsigned int y = 0; y < weights.size2(); y++)
+                    w.value(weights(x, y));
+                w.end_array();
+            }
+            w.end_array();
+
+            w.key("biases");
+            w.begin_array();
+            for (unsigned int i = 0; i < biases.size(); i++)
+                w.value(biases[i]);
+            w.end_array();
+
+            w.end_object();
+        }
+
         //! Display function
         friend
         std::ostream &operator<< (std::ostream &oss, const Layer<T> &l)
@@ -122,8 +332,9 @@ namespace ffnn
         {
             unsigned int input_size = tree.get("input_size", 0);
             unsigned int output_size = tree.get("output_size", 0);
-            //TODO : select the right function
             std::string threshold_fct = tree.get("threshold_function", "");
+            if (!activation_from_name(threshold_fct, activation))
+                return false;
 
             biases.resize(output_size);
             int i = 0;
@@ -161,6 +372,63 @@ namespace ffnn
             return true;
         }
 
+        //! Streaming version of load(), reading a layer object written
+        //! by serialize(). The values are parsed straight into the
+        //! weights and biases when the sizes come first, as serialize()
+        //! writes them.
+        bool load(json::Reader &r)
+        {
+            unsigned int input_size = 0, output_size = 0;
+            bool has_weights = false, has_biases = false;
+            std::string key;
+
+            weights.resize(0, 0, false);
+            biases.resize(0, false);
+            activation = ActivationId::custom;
+
+            if (!r.begin_object())
+                return false;
+            while (r.next_key(key))
+            {
+                bool ok = true;
+                if (key == "threshold_function")
+                {
+                    std::string name;
+                    ok = r.read_string(name) && activation_from_name(name, activation);
+                }
+                else if (key == "input_size")
+                    ok = r.read_number(input_size);
+                else if (key == "output_size")
+                    ok = r.read_number(output_size);
+                else if (key == "weights")
+                    ok = has_weights = load_weights(r, input_size, output_size);
+                else if (key == "biases")
+                    ok = has_biases = load_biases(r, output_size);
+                else
+                    ok = r.skip_value();
+
+                if (!ok)
+                    break;
+            }
+
+            // The sizes are optional, the ones of the weights are used.
+            if (!input_size && !output_size)
+            {
+                input_size = weights.size2();
+                output_size = weights.size1();
+            }
+            if (!r.good() || !has_weights || !has_biases
+                || activation == ActivationId::custom
+                || weights.size1() != output_size || weights.size2() != input_size
+                || biases.size() != output_size)
+            {
+                weights.resize(0, 0, false);
+                biases.resize(0, false);
+                return false;
+            }
+            return true;
+        }
+
         bool empty() const
         {
             if (weights.size1() == 0
@@ -179,15 +447,84 @@ namespace ffnn
             return true;
         }
 
-        //! Random generator engine. Used by randomize() and
-        //! randomize_int().
+        //! Random generator engine. Only used by randomize() and
+        //! randomize_int() without an engine: the const members never
+        //! touch it, and a const Layer can be read by several threads.
         std::minstd_rand eng;
 
     private:
+        //! Read the weights array. When the sizes are still unknown
+        //! (0), the rows are read in a buffer and the matrix is
+        //! sized afterwards.
+        bool load_weights(json::Reader &r, unsigned int input_size, unsigned int output_size)
+        {
+            const bool sized = input_size && output_size;
+            std::vector<T> buffer;
+            unsigned int rows = 0, cols = 0;
+
+            if (sized)
+                weights.resize(output_size, input_size, false);
+            if (!r.begin_array())
+                return false;
+            while (r.next_element())
+            {
+                if (!r.begin_array() || (sized && rows >= output_size))
+                    return false;
+                unsigned int y = 0;
+                while (r.next_element())
+                {
+                    T v;
+                    if ((sized && y >= input_size) || !r.read_number(v))
+                        return false;
+                    if (sized)
+                        weights(rows, y) = v;
+                    else
+                        buffer.push_back(v);
+                    y++;
+                }
+                if (rows > 0 && y != cols)
+                    return false;
+                cols = y;
+                rows++;
+            }
+            if (!r.good())
+                return false;
+
+            if (!sized)
+            {
+                weights.resize(rows, cols, false);
+                std::copy(buffer.begin(), buffer.end(), weights.data().begin());
+            }
+            return weights.size1() == rows && weights.size2() == cols;
+        }
+
+        bool load_biases(json::Reader &r, unsigned int output_size)
+        {
+            std::vector<T> buffer;
+            if (output_size)
+                buffer.reserve(output_size);
+            if (!r.begin_array())
+                return false;
+            while (r.next_element())
+            {
+                T v;
+                if (!r.read_number(v))
+                    return false;
+                buffer.push_back(v);
+            }
+            biases.resize(buffer.size(), false);
+            std::copy(buffer.begin(), buffer.end(), biases.begin());
+            return r.good();
+        }
+
         //! Weights of the neural network applied to the inputs.
         matrix<T> weights;
         //! Biases aplied befor computing the threshold function.
         vector<T> biases;
+        //! The compile time activation used by the threshold function.
+        //! When custom, threshold_function and derivative_function
+        //! are used instead.
+        ActivationId activation;
         //! The threshold function applied to the weighted sum of inputs.
         std::function<T(T)> threshold_function;
         //! The function used to compute the derivate.
@@ -199,19 +536,7 @@ namespace ffnn
 
 
     template<typename T>
-    T sigmoid(const T x)
-    {
-        return static_cast<T>(1) / (static_cast<T>(1) + exp(-x));
-    };
-
-    template<typename T>
-    T sigmoid_prime(const T a)
-    {
-        return a * (static_cast<T>(1) - a);
-    };
-
-    template<typename T>
-    vector<T> operator>> (const vector<T> &input, const Layer<T> layer)
+    vector<T> operator>> (const vector<T> &input, const Layer<T> &layer)
     {
         return layer << input;
     }
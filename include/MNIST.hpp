@@ -4,6 +4,7 @@
 #include <boost/numeric/ublas/matrix.hpp>
 #include <list>
 #include <string>
+#include <vector>
 
 namespace MNIST
 {
@@ -33,6 +34,142 @@ namespace MNIST
         unsigned int count;
         std::vector<word8> labels;
     };
+
+    /**
+     * An IDX file of unsigned bytes, the format of the MNIST sets,
+     * mapped in memory. The items (images or labels) are views over
+     * the mapped bytes: nothing is copied when loading.
+     */
+    class IdxFile
+    {
+    public:
+        IdxFile();
+        ~IdxFile();
+
+        IdxFile(const IdxFile &) = delete;
+        IdxFile &operator= (const IdxFile &) = delete;
+
+        //! Map filename, and check its magic number, its number of
+        //! dimensions and that its size match its shape.
+        //! \return false if the file can't be mapped or isn't valid.
+        bool open(std::string filename, unsigned int dimensions);
+        void close();
+
+        //! Size of each dimension, the first one being the number of items.
+        const std::vector<unsigned int> &shape() const {return dims;};
+        //! Number of items.
+        unsigned int count() const {return dims.empty() ? 0 : dims[0];};
+        //! Number of bytes of an item, the product of the other dimensions.
+        std::size_t item_size() const {return stride;};
+        //! The item i, item_size() contiguous bytes.
+        const word8 *item(unsigned int i) const {return items + i * stride;};
+
+    private:
+        const word8 *map;
+        std::size_t map_size;
+        const word8 *items;
+        std::size_t stride;
+        std::vector<unsigned int> dims;
+    };
+
+    //! Memory mapped version of ImageSet.
+    class MappedImageSet : public IdxFile
+    {
+    public:
+        bool load(std::string filename) {return open(filename, 3);};
+
+        unsigned int h() const {return shape()[1];};
+        unsigned int w() const {return shape()[2];};
+        const word8 *image(unsigned int i) const {return item(i);};
+    };
+
+    //! Memory mapped version of LabelSet.
+    class MappedLabelSet : public IdxFile
+    {
+    public:
+        bool load(std::string filename) {return open(filename, 1);};
+
+        word8 label(unsigned int i) const {return *item(i);};
+    };
+
+    //! \return true if every item of set is a single byte below classes.
+    inline bool labels_below(const IdxFile &set, unsigned int classes)
+    {
+        if (set.item_size() != 1)
+            return false;
+        for (unsigned int i = 0; i < set.count(); i++)
+            if (*set.item(i) >= classes)
+                return false;
+        return true;
+    }
+
+    //! Convert the images [first, first + batch.size2()) of set to T,
+    //! scaled to [0, 1], one image per column of batch.
+    template<typename T>
+    void images_to_batch(const IdxFile &set, unsigned int first, matrix<T> &batch)
+    {
+        const T scale = T(1) / 255;
+        for (unsigned int j = 0; j < batch.size2(); j++)
+        {
+            const word8 *image = set.item(first + j);
+            for (unsigned int i = 0; i < batch.size1(); i++)
+                batch(i, j) = image[i] * scale;
+        }
+    }
+
+    //! Convert the labels [first, first + batch.size2()) of set to
+    //! one-hot columns of batch.
+    //! \return false if a label isn't below batch.size1(), its column
+    //!         being left to zero.
+    template<typename T>
+    bool labels_to_batch(const IdxFile &set, unsigned int first, matrix<T> &batch)
+    {
+        bool valid = true;
+        batch.clear();
+        for (unsigned int j = 0; j < batch.size2(); j++)
+        {
+            const word8 label = *set.item(first + j);
+            if (label < batch.size1())
+                batch(label, j) = 1;
+            else
+                valid = false;
+        }
+        return valid;
+    }
+
+    //! Convert the images indices[0], ..., indices[batch.size2() - 1]
+    //! of set to T, scaled to [0, 1], one image per column of batch.
+    template<typename T>
+    void images_to_batch(const IdxFile &set, const unsigned int *indices, matrix<T> &batch)
+    {
+        const T scale = T(1) / 255;
+        for (unsigned int j = 0; j < batch.size2(); j++)
+        {
+            const word8 *image = set.item(indices[j]);
+            for (unsigned int i = 0; i < batch.size1(); i++)
+                batch(i, j) = image[i] * scale;
+        }
+    }
+
+    //! Convert the labels indices[0], ..., indices[batch.size2() - 1]
+    //! of set to one-hot columns of batch.
+    //! \return false if a label isn't below batch.size1(), its column
+    //!         being left to zero.
+    template<typename T>
+    bool labels_to_batch(const IdxFile &set, const unsigned int *indices, matrix<T> &batch)
+    {
+        bool valid = true;
+        batch.clear();
+        for (unsigned int j = 0; j < batch.size2(); j++)
+        {
+            const word8 label = *set.item(indices[j]);
+            if (label < batch.size1())
+                batch(label, j) = 1;
+            else
+                valid = false;
+        }
+        return valid;
+    }
 };
 
 #endif /* !MNIST_HPP_ */
@@ -0,0 +1,163 @@
+#ifndef MAPPEDNETWORK_HPP_
+#define MAPPEDNETWORK_HPP_
+
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <boost/numeric/ublas/vector.hpp>
+
+#include "Activation.hpp"
+#include "BinaryFormat.hpp"
+#include "Gemm.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * A network read from a file written by Network::save_binary.
+     *
+     * The file is mapped in memory and the weights and biases are
+     * used in place: opening a model costs the validation of its
+     * header, not a copy of its weights, and pages are only read
+     * when they are first used. The model is read only, and can be
+     * evaluated by several threads, each with its own Scratch.
+     */
+    template<typename T>
+    class MappedNetwork
+    {
+    public:
+        //! Buffers used by eval, to not allocate at each call.
+        struct Scratch
+        {
+            vector<T> input;
+            vector<T> output;
+        };
+
+        MappedNetwork()
+            :data(nullptr), size(0)
+        {};
+        explicit MappedNetwork(const std::string &filename)
+            :data(nullptr), size(0)
+        {
+            open(filename);
+        };
+        ~MappedNetwork()
+        {
+            close();
+        };
+
+        MappedNetwork(const MappedNetwork &) = delete;
+        MappedNetwork &operator= (const MappedNetwork &) = delete;
+
+        //! Map the file and check it is a model made of T.
+        //! \return false if the file can't be mapped or isn't valid.
+        bool open(const std::string &filename)
+        {
+            close();
+
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) || st.st_size == 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (p == MAP_FAILED)
+                return false;
+
+            data = static_cast<const char *>(p);
+            size = st.st_size;
+            if (!binary::check<T>(data, size))
+            {
+                close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+            if (data)
+                munmap(const_cast<char *>(data), size);
+            data = nullptr;
+            size = 0;
+        }
+
+        bool empty() const {return !data || layer_count() == 0;};
+
+        unsigned int layer_count() const
+        {return data ? header().layer_count : 0;};
+        unsigned int get_input_size(unsigned int l) const
+        {return entry(l).input_size;};
+        unsigned int get_output_size(unsigned int l) const
+        {return entry(l).output_size;};
+        ActivationId get_activation(unsigned int l) const
+        {return static_cast<ActivationId>(entry(l).activation);};
+
+        //! Weights of the layer l, row major, output_size x input_size.
+        const T *weights(unsigned int l) const
+        {return reinterpret_cast<const T *>(data + entry(l).weights_offset);};
+        //! Biases of the layer l.
+        const T *biases(unsigned int l) const
+        {return reinterpret_cast<const T *>(data + entry(l).biases_offset);};
+
+        //! Evaluate the network, like Network::eval.
+        vector<T> eval(const vector<T> &input) const
+        {
+            Scratch s;
+            return eval(s, input);
+        }
+
+        //! Evaluate the network using the buffers of s.
+        //! \return A reference to the output, stored inside s.
+        const vector<T> &eval(Scratch &s, const vector<T> &input) const
+        {
+            if (layer_count() == 0)
+            {
+                s.output = input;
+                return s.output;
+            }
+            const T *in = &input[0];
+            for (unsigned int l = 0; l < layer_count(); l++)
+            {
+                if (l > 0)
+                    s.input.swap(s.output);
+                if (s.output.size() != get_output_size(l))
+                    s.output.resize(get_output_size(l), false);
+                forward(l, in, &s.output[0]);
+                in = &s.output[0];
+            }
+            return s.output;
+        }
+
+        //! Compute the output of the layer l for input, into output.
+        void forward(unsigned int l, const T *input, T *output) const
+        {
+            const unsigned int rows = get_output_size(l);
+            gemm::gemv(rows, get_input_size(l), weights(l), input, output);
+            activate(get_activation(l), output, biases(l), rows, 1);
+        }
+
+    private:
+        const binary::Header &header() const
+        {return *reinterpret_cast<const binary::Header *>(data);};
+        const binary::LayerEntry &entry(unsigned int l) const
+        {return reinterpret_cast<const binary::LayerEntry *>(data + sizeof(binary::Header))[l];};
+
+        //! Start of the mapping, nullptr when closed.
+        const char *data;
+        //! Size of the mapping in bytes.
+        std::size_t size;
+    };
+}
+
+#endif /* !MAPPEDNETWORK_HPP_ */
@@ -0,0 +1,221 @@
+#ifndef MIXEDNETWORK_HPP_
+#define MIXEDNETWORK_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include "Gemm.hpp"
+#include "Half.hpp"
+#include "Network.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * Mixed precision version of Network<float>.
+     *
+     * The weights used by the forward and backward passes are
+     * stored as S (half or bfloat16), which halves their memory
+     * compared to float. Products are accumulated
+     * in float, and the updates are applied to a float master copy
+     * of the network, rounded to S after each step: small updates
+     * accumulate in the master instead of being lost to the
+     * rounding of S.
+     *
+     * A single sample is evaluated by gemm::gemv straight from the
+     * weights stored as S. The batched products go through
+     * gemm::multiply, the weights being converted to float a block
+     * at a time, once per batch. With either S, eval and train are
+     * slower than Network<float>, the conversions costing more than
+     * the bandwidth they save: S only saves memory, not time.
+     *
+     * Only the layers using one of the activations of Activation.hpp
+     * are supported, not custom ones.
+     */
+    template<typename S>
+    class MixedNetwork
+    {
+    public:
+        MixedNetwork() {};
+        explicit MixedNetwork(const Network<float> &net)
+        {
+            load(net);
+        };
+
+        //! Use a copy of net as master, and round it to S.
+        //! \return false if a layer has a custom activation.
+        bool load(const Network<float> &net)
+        {
+            for (const auto &layer : net.get_layers())
+                if (layer.get_activation() == ActivationId::custom)
+                    return false;
+            master = net;
+            sync();
+            return true;
+        }
+
+        //! The float master copy, updated by training.
+        const Network<float> &get_master() const {return master;};
+
+        //! Number of bytes used by the weights stored as S.
+        std::size_t storage_size() const
+        {
+            std::size_t size = 0;
+            for (const auto &w : weights)
+                size += w.size() * sizeof(S);
+            return size;
+        }
+
+        //! Evaluate the network using the buffers of ws.
+        //! \return A reference to the output, stored inside ws.
+        const vector<float> &eval(Workspace<float> &ws, const vector<float> &input) const
+        {
+            const auto &layers = master.get_layers();
+            ws.resize(layers);
+            noalias(ws.activations[0]) = input;
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                vector<float> &z = ws.activations[l + 1];
+                multiply(l, &ws.activations[l][0], 1, &z[0]);
+                activate(layers[l].get_activation(), &z[0], &layers[l].get_biases()[0], z.size(), 1);
+            }
+            return ws.activations.back();
+        }
+
+        //! Same as Network::forward_batch, into ws.batch_activations.
+        template<class E>
+        void forward_batch(Workspace<float> &ws, const matrix_expression<E> &inputs) const
+        {
+            const auto &layers = master.get_layers();
+            const unsigned int batch_size = inputs().size2();
+            ws.resize(layers, batch_size);
+            noalias(ws.batch_activations[0]) = inputs;
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                matrix<float> &z = ws.batch_activations[l + 1];
+                multiply(l, &ws.batch_activations[l].data()[0], batch_size, &z.data()[0]);
+                activate(layers[l].get_activation(), &z.data()[0],
+                         &layers[l].get_biases()[0], z.size1(), batch_size);
+            }
+        }
+
+        //! Same as Network::train_batch. The gradients are computed
+        //! with the weights stored as S, and applied to the master.
+        template<class E1, class E2>
+        void train_batch(Workspace<float> &ws, float h, const matrix_expression<E1> &inputs,
+                         const matrix_expression<E2> &outputs)
+        {
+            const auto &layers = master.get_layers();
+            if (layers.empty())
+                return;
+            const unsigned int batch_size = inputs().size2();
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+            forward_batch(ws, inputs);
+            auto &a_vec = ws.batch_activations;
+            auto &delta_list = ws.batch_deltas;
+
+            // Same as in Network::compute_gradients.
+            const unsigned int L = layers.size();
+            noalias(delta_list[L]) = a_vec[L] - outputs;
+            layers[L - 1].derivative_mask(delta_list[L], a_vec[L]);
+            for (unsigned int l = L - 1; l > 0; l--)
+            {
+                multiply_trans(l, &delta_list[l + 1].data()[0], batch_size, &delta_list[l].data()[0]);
+                layers[l - 1].derivative_mask(delta_list[l], a_vec[l]);
+            }
+
+            const scalar_vector<float> ones(batch_size, 1);
+            for (unsigned int l = 1; l <= L; l++)
+            {
+                matrix<float> &g = ws.weight_gradients[l - 1];
+                gemm::multiply(g.size1(), g.size2(), batch_size,
+                               gemm::row_major(&delta_list[l].data()[0], batch_size),
+                               gemm::row_major(&a_vec[l - 1].data()[0], batch_size).trans(),
+                               &g.data()[0], g.size2());
+                noalias(ws.bias_gradients[l - 1]) = prod(delta_list[l], ones);
+            }
+
+            master.apply_gradients(ws, h / batch_size);
+            sync();
+        }
+
+        //! Round the master weights to S.
+        void sync()
+        {
+            const auto &layers = master.get_layers();
+            weights.resize(layers.size());
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                const matrix<float> &w = layers[l].get_weights();
+                weights[l].resize(w.size1() * w.size2());
+                for (std::size_t i = 0; i < weights[l].size(); i++)
+                    weights[l][i] = S(w.data()[i]);
+            }
+        }
+
+    private:
+        //! Conversion buffer of the calling thread, which only grows.
+        static float *buffer(std::size_t size)
+        {
+            static thread_local std::vector<float> converted;
+            if (converted.size() < size)
+                converted.resize(size);
+            return converted.data();
+        }
+
+        //! z = W_l a, a being input_size x n and z output_size x n,
+        //! both row major.
+        void multiply(unsigned int l, const float *a, unsigned int n, float *z) const
+        {
+            const Layer<float> &layer = master.get_layers()[l];
+            const unsigned int rows = layer.get_output_size();
+            const unsigned int cols = layer.get_input_size();
+            const S *w = &weights[l][0];
+            if (n == 1)
+            {
+                gemm::gemv(rows, cols, w, a, z);
+                return;
+            }
+            // Blocks of gemm::mc rows of W, each giving the same rows of z.
+            float *converted = buffer(std::size_t(std::min(gemm::mc, rows)) * cols);
+            for (unsigned int i = 0; i < rows; i += gemm::mc)
+            {
+                const unsigned int m = std::min(gemm::mc, rows - i);
+                std::copy(w + std::size_t(i) * cols, w + std::size_t(i + m) * cols, converted);
+                gemm::multiply(m, n, cols, gemm::row_major(converted, cols),
+                               gemm::row_major(a, n), z + std::size_t(i) * n, n);
+            }
+        }
+
+        //! d = trans(W_l) e, e being output_size x n and d input_size x n,
+        //! both row major.
+        void multiply_trans(unsigned int l, const float *e, unsigned int n, float *d) const
+        {
+            const Layer<float> &layer = master.get_layers()[l];
+            const unsigned int rows = layer.get_output_size();
+            const unsigned int cols = layer.get_input_size();
+            const S *w = &weights[l][0];
+            // Blocks of gemm::mc columns of W, each giving the same rows of d.
+            const unsigned int width = std::min(gemm::mc, cols);
+            float *converted = buffer(std::size_t(rows) * width);
+            for (unsigned int j = 0; j < cols; j += gemm::mc)
+            {
+                const unsigned int m = std::min(gemm::mc, cols - j);
+                for (unsigned int i = 0; i < rows; i++)
+                {
+                    const S *wi = w + std::size_t(i) * cols + j;
+                    std::copy(wi, wi + m, converted + std::size_t(i) * m);
+                }
+                gemm::multiply(m, n, rows, gemm::row_major(converted, m).trans(),
+                               gemm::row_major(e, n), d + std::size_t(j) * n, n);
+            }
+        }
+
+        Network<float> master;
+        //! Weights of each layer of master, row major, rounded to S.
+        std::vector<std::vector<S>> weights;
+    };
+}
+
+#endif /* !MIXEDNETWORK_HPP_ */
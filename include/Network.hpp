@@ -2,20 +2,39 @@
 #define NETWORK_HPP_
 
 #include <Layer.hpp>
+#include <Workspace.hpp>
+#include <ThreadPool.hpp>
+#include <BinaryFormat.hpp>
+#include <Evaluation.hpp>
+#include <Optimizer.hpp>
+#include <Checkpoint.hpp>
 
 #include <boost/numeric/ublas/matrix_sparse.hpp>
 #include <boost/numeric/ublas/vector_sparse.hpp>
-#include <boost/range/adaptor/reversed.hpp>
 
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include <cstring>
 #include <fstream>
 
 namespace ffnn
 {
     using namespace boost::numeric::ublas;
 
+    /**
+     * A list of layers, trained by backpropagation.
+     *
+     * The const members (forward, forward_batch, eval and
+     * compute_gradients) only read the layers, the buffers they
+     * write being in the Workspace given by the caller. One Network
+     * can be shared by many threads, without copies or locks, as
+     * long as each thread uses its own Workspace and nothing trains
+     * or loads the network meanwhile.
+     *
+     * With FFNN_PROFILE defined, each phase of each layer is timed
+     * and recorded by profile::profiler(), see Profile.hpp.
+     */
     template<typename T>
     class Network
     {
@@ -42,88 +61,659 @@ namespace ffnn
         {layers.pop_back();};
 
         //! Return the list of layers
-        const layer_list& get_layers()
+        const layer_list& get_layers() const
         {return layers;};
 
         //! Compute forward pass of the network
         //! \return The list of neuron outputs. The input is saw as the first layer.
-        std::vector<vector<T>> forward(const vector<T> &input)
+        std::vector<vector<T>> forward(const vector<T> &input) const
         {
-            std::vector<vector<T>> out_list;
+            Workspace<T> ws(layers);
+            forward(ws, input);
+            return ws.activations;
+        }
 
-            out_list.push_back(input);
-            for (auto layer : layers)
-                out_list.push_back(layer << out_list.back());
+        //! Compute forward pass of the network into ws.activations.
+        //! Doesn't allocate if ws is already sized for this network.
+        //! input can be any vector expression, such as a column of a batch.
+        template<class E>
+        void forward(Workspace<T> &ws, const vector_expression<E> &input) const
+        {
+            ws.resize(layers);
+            noalias(ws.activations[0]) = input;
+            for (unsigned int i = 0; i < layers.size(); i++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, i, product_flops(layers[i], 1),
+                                   product_bytes(layers[i], 1));
+                layers[i].forward(ws.activations[i], ws.activations[i + 1]);
+            }
+        }
 
-            return out_list;
+        //! Same as above for a sparse input, the first layer only
+        //! reading the weights matching its nonzeros. The input isn't
+        //! copied, ws.activations[0] is left as is.
+        void forward(Workspace<T> &ws, const compressed_vector<T> &input) const
+        {
+            ws.resize(layers);
+            if (layers.empty())
+                return;
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, 0, sparse_flops(layers[0], input.nnz()),
+                                   sparse_bytes(layers[0], input.nnz()));
+                layers[0].forward(input, ws.activations[1]);
+            }
+            for (unsigned int i = 1; i < layers.size(); i++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, i, product_flops(layers[i], 1),
+                                   product_bytes(layers[i], 1));
+                layers[i].forward(ws.activations[i], ws.activations[i + 1]);
+            }
         }
 
         //! Evaluate a network
-        vector<T> eval(const vector<T> &input)
+        vector<T> eval(const vector<T> &input) const
         {
             vector<T> output(input);
-            for (auto layer : layers)
+            for (const auto &layer : layers)
                 output = output >> layer;
             return output;
         }
 
+        //! Evaluate a network using the buffers of ws.
+        //! \return A reference to the output, stored inside ws.
+        template<class E>
+        const vector<T> &eval(Workspace<T> &ws, const vector_expression<E> &input) const
+        {
+            forward(ws, input);
+            return ws.activations.back();
+        }
+
+        //! Same as above for a sparse input.
+        const vector<T> &eval(Workspace<T> &ws, const compressed_vector<T> &input) const
+        {
+            forward(ws, input);
+            return ws.activations.back();
+        }
+
         void train(T h, const vector<T> &input, const vector<T> &output)
         {
+            Workspace<T> ws(layers);
+            train(ws, h, input, output);
+        }
+
+        //! Same as train(h, input, output), using the buffers of ws.
+        //! Doesn't allocate if ws is already sized for this network.
+        //! input and output can be any vector expression, a sparse one
+        //! included.
+        template<class E1, class E2>
+        void train(Workspace<T> &ws, T h, const vector_expression<E1> &input,
+                   const vector_expression<E2> &output)
+        {
+            if (layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, 1);
+
             //////////////////////////////////////////
             // Compute the forward pass from the input
             //
-            auto a_vec = forward(input);
+            forward(ws, input);
+            backward(ws, output);
+            auto &a_vec = ws.activations;
+            auto &delta_list = ws.deltas;
 
-            /////////////
-            // Compute the delta_list, wich is the list of all derivative
-            // dC_over_dz where z_l is the weightenen sum of an input incoming
-            // into the layer l.
+            ///////////////////////////////////////////////////////////////
+            // The derivative of the weights and the biases are
+            // dC_over_dw = outer_prod(delta, a) and dC_over_db = delta.
+            // Apply the modification to the layer without storing them.
+            for (unsigned int l = 1; l <= layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l - 1, product_flops(layers[l - 1], 1),
+                                   update_bytes(layers[l - 1]));
+                noalias(layers[l - 1].weights) -= h * outer_prod(delta_list[l], a_vec[l - 1]);
+                noalias(layers[l - 1].biases) -= h * delta_list[l];
+            }
+        }
 
-            // L means the last layer, and l a layer beetween 1(input) and L.
-            // dC_over_da means the gradient of C on the direction a.
-            auto dC_over_da = a_vec.back() - output;
+        //! Same as train(ws, h, input, output), the step being made by
+        //! optimizer. The gradient of each row of the weights is the
+        //! row of an outer product, computed by the optimizer in the
+        //! same loop as its step.
+        template<class E1, class E2>
+        void train(Workspace<T> &ws, Optimizer<T> &optimizer, const vector_expression<E1> &input,
+                   const vector_expression<E2> &output)
+        {
+            if (layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, 1);
+
+            forward(ws, input);
+            backward(ws, output);
+            optimizer.prepare(layers);
+            optimizer.begin_update();
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l, product_flops(layers[l], 1),
+                                   update_bytes(layers[l]));
+                const unsigned int rows = layers[l].get_output_size();
+                const unsigned int cols = layers[l].get_input_size();
+                const T *d = ws.deltas[l + 1].data().begin();
+                const T *a = ws.activations[l].data().begin();
+                T *w = layers[l].weights.data().begin();
+                for (unsigned int i = 0; i < rows; i++)
+                    optimizer.update_outer(l, std::size_t(i) * cols, cols, w + std::size_t(i) * cols,
+                                           d[i], a);
+                optimizer.update(l, std::size_t(rows) * cols, rows,
+                                 layers[l].biases.data().begin(), d, T(1));
+            }
+        }
 
-            // The delta list is the list of all gradients in reverse order
-            std::vector<vector<T>> delta_list;
+        //! Same as above for a sparse input. The weights of the first
+        //! layer matching the zeros of the input have a null gradient,
+        //! only the other ones are read and updated.
+        template<class E>
+        void train(Workspace<T> &ws, T h, const compressed_vector<T> &input,
+                   const vector_expression<E> &output)
+        {
+            if (layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, 1);
 
-            // Reverse order browsing of outputs of neurons
-            auto a_vec_it = a_vec.rbegin();
-            //Delta L :
-            vector<T> delta_L = element_prod(dC_over_da,
-                                                    layers.back().derivative_function % *a_vec_it);
-            delta_list.push_back(delta_L);
-            a_vec_it++;
-            for (auto l : boost::adaptors::reverse(layers))
-            {
-                auto exp1 = prod(trans(l.weights), delta_list.back());
-                auto exp2 = l.derivative_function % *a_vec_it;
-                delta_list.push_back(element_prod(exp1, exp2));
-                //Notice we are also computing the derivative of C over
-                //the input, wich could be used to extract 'images patchs'.
-                a_vec_it++;
-            };
+            forward(ws, input);
+            backward(ws, output);
+            auto &a_vec = ws.activations;
+            auto &delta_list = ws.deltas;
 
-            ///////////////////////////////////////////////////////////////
-            // Compute the derivative of the weights and the biases, namely
-            // dC_over_dw and dC_over_db = delta_list and apply the modification
-            // to the layer. They are stored in reverse order.
-            //auto &dC_over_db = delta_list;
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, 0, sparse_flops(layers[0], input.nnz()),
+                                   2 * sparse_bytes(layers[0], input.nnz()));
+                matrix<T> &w = layers[0].weights;
+                const std::size_t starts[2] = {0, input.nnz()};
+                gemm::add_product_sparse(w.size1(), 1, w.size2(), -h, delta_list[1].data().begin(), 1,
+                                         starts, input.index_data().begin(),
+                                         input.value_data().begin(), w.data().begin());
+                noalias(layers[0].biases) -= h * delta_list[1];
+            }
+            for (unsigned int l = 2; l <= layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l - 1, product_flops(layers[l - 1], 1),
+                                   update_bytes(layers[l - 1]));
+                noalias(layers[l - 1].weights) -= h * outer_prod(delta_list[l], a_vec[l - 1]);
+                noalias(layers[l - 1].biases) -= h * delta_list[l];
+            }
+        }
+
+        //! Compute forward pass of the network on a batch of samples
+        //! stored as the columns of inputs.
+        //! \return The list of neuron outputs. The input is saw as the first layer.
+        std::vector<matrix<T>> forward_batch(const matrix<T> &inputs) const
+        {
+            Workspace<T> ws;
+            forward_batch(ws, inputs);
+            return ws.batch_activations;
+        }
+
+        //! Compute forward pass of the network on a batch into
+        //! ws.batch_activations. Doesn't allocate if ws is already
+        //! sized for this network and batch size.
+        template<class E>
+        void forward_batch(Workspace<T> &ws, const matrix_expression<E> &inputs) const
+        {
+            const unsigned int batch_size = inputs().size2();
+            ws.resize(layers, batch_size);
+            noalias(ws.batch_activations[0]) = inputs;
+            for (unsigned int i = 0; i < layers.size(); i++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, i, product_flops(layers[i], batch_size),
+                                   product_bytes(layers[i], batch_size));
+                layers[i].forward(ws.batch_activations[i], ws.batch_activations[i + 1]);
+            }
+        }
+
+        //! Same as above for sparse inputs, one sample per column.
+        //! The inputs aren't copied, ws.batch_activations[0] is left
+        //! as is.
+        void forward_batch(Workspace<T> &ws, const compressed_matrix<T, column_major> &inputs) const
+        {
+            const unsigned int batch_size = inputs.size2();
+            ws.resize(layers, batch_size, false);
+            if (layers.empty())
+                return;
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, 0, sparse_flops(layers[0], inputs.nnz()),
+                                   sparse_bytes(layers[0], inputs.nnz()));
+                layers[0].forward(inputs, ws.batch_activations[1]);
+            }
+            for (unsigned int i = 1; i < layers.size(); i++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, i, product_flops(layers[i], batch_size),
+                                   product_bytes(layers[i], batch_size));
+                layers[i].forward(ws.batch_activations[i], ws.batch_activations[i + 1]);
+            }
+        }
+
+        //! Train the network on a mini-batch. Each column of inputs is a
+        //! sample and the same column of outputs is the expected result.
+        //! The gradients of the whole batch are accumulated and one update,
+        //! averaged over the batch size, is applied to each layer.
+        void train_batch(T h, const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            Workspace<T> ws;
+            train_batch(ws, h, inputs, outputs);
+        }
+
+        //! Same as train_batch(h, inputs, outputs), using the buffers of ws.
+        //! Doesn't allocate if ws is already sized for this network and
+        //! batch size.
+        void train_batch(Workspace<T> &ws, T h, const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+
+            compute_gradients(ws, inputs, outputs);
+            apply_gradients(ws, h / batch_size);
+        }
+
+        //! Same as train_batch(ws, h, inputs, outputs), the step being
+        //! made by optimizer. The gradients aren't stored for the whole
+        //! layers: they are computed a few rows at a time into
+        //! ws.gradient_tile, and applied while still in the cache.
+        void train_batch(Workspace<T> &ws, Optimizer<T> &optimizer, const matrix<T> &inputs,
+                         const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+
+            forward_batch(ws, inputs);
+            backward_batch(ws, outputs);
+            optimizer.prepare(layers);
+            optimizer.begin_update();
+            const T scale = T(1) / batch_size;
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l,
+                                   product_flops(layers[l], batch_size) + product_flops(layers[l], 1),
+                                   product_bytes(layers[l], batch_size) + update_bytes(layers[l]));
+                const unsigned int rows = layers[l].get_output_size();
+                const unsigned int cols = layers[l].get_input_size();
+                const T *d = ws.batch_deltas[l + 1].data().begin();
+                const T *a = ws.batch_activations[l].data().begin();
+                T *w = layers[l].weights.data().begin();
+                T *b = layers[l].biases.data().begin();
+
+                // About 16384 gradients, enough rows for gemm::multiply
+                // to amortize its packing, followed by the ones of the
+                // biases of the same rows.
+                const unsigned int tile_rows = std::min(rows, std::max(1u, 16384 / cols));
+                const std::size_t tile_size = std::size_t(tile_rows) * (cols + 1);
+                if (ws.gradient_tile.size() < tile_size)
+                    ws.gradient_tile.resize(tile_size);
+                T *g = ws.gradient_tile.data();
+                T *g_biases = g + std::size_t(tile_rows) * cols;
+                for (unsigned int r = 0; r < rows; r += tile_rows)
+                {
+                    const unsigned int n = std::min(tile_rows, rows - r);
+                    const T *d_rows = d + std::size_t(r) * batch_size;
+                    gemm::multiply(n, cols, batch_size,
+                                   gemm::row_major(d_rows, batch_size),
+                                   gemm::row_major(a, batch_size).trans(), g, cols);
+                    for (unsigned int i = 0; i < n; i++)
+                    {
+                        T sum = 0;
+                        for (unsigned int k = 0; k < batch_size; k++)
+                            sum += d_rows[std::size_t(i) * batch_size + k];
+                        g_biases[i] = sum;
+                    }
+                    optimizer.update(l, std::size_t(r) * cols, std::size_t(n) * cols,
+                                     w + std::size_t(r) * cols, g, scale);
+                    optimizer.update(l, std::size_t(rows) * cols + r, n, b + r, g_biases, scale);
+                }
+            }
+        }
+
+        //! Same as train_batch(ws, h, inputs, outputs), with the
+        //! memory of the activations bounded by plan, see
+        //! compute_gradients(ws, plan, inputs, outputs).
+        void train_batch(Workspace<T> &ws, const CheckpointPlan &plan, T h,
+                         const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+
+            compute_gradients(ws, plan, inputs, outputs);
+            apply_gradients(ws, h / batch_size);
+        }
+
+        //! Same as above, the step being made by optimizer.
+        void train_batch(Workspace<T> &ws, const CheckpointPlan &plan, Optimizer<T> &optimizer,
+                         const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+
+            compute_gradients(ws, plan, inputs, outputs);
+            apply_gradients(ws, optimizer, T(1) / batch_size);
+        }
+
+        //! Same as above for sparse inputs, one sample per column.
+        //! The gradient of the first layer isn't stored: it is
+        //! applied directly to the weights matching the nonzeros of
+        //! the inputs, the other ones having a null gradient.
+        void train_batch(Workspace<T> &ws, T h, const compressed_matrix<T, column_major> &inputs,
+                         const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+
+            forward_batch(ws, inputs);
+            backward_batch(ws, outputs);
+            batch_gradients(ws, 1);
+
+            const T rate = h / batch_size;
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, 0, sparse_flops(layers[0], inputs.nnz()),
+                                   2 * sparse_bytes(layers[0], inputs.nnz()));
+                matrix<T> &w = layers[0].weights;
+                gemm::add_product_sparse(w.size1(), inputs.filled1() - 1, w.size2(), -rate,
+                                         ws.batch_deltas[1].data().begin(), batch_size,
+                                         inputs.index1_data().begin(), inputs.index2_data().begin(),
+                                         inputs.value_data().begin(), w.data().begin());
+                noalias(layers[0].biases) -= rate * ws.bias_gradients[0];
+            }
+            for (unsigned int l = 1; l < layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l, product_flops(layers[l], 1),
+                                   update_bytes(layers[l]));
+                noalias(layers[l].weights) -= rate * ws.weight_gradients[l];
+                noalias(layers[l].biases) -= rate * ws.bias_gradients[l];
+            }
+        }
+
+        //! Data-parallel version of train_batch(ws, h, inputs, outputs).
+        //! The batch is split in pool.size() shards of consecutive columns,
+        //! the shard k computing its gradients into workspaces[k]. They are
+        //! then summed in shard order, so the result only depends on the
+        //! number of threads, not on the scheduling.
+        void train_batch(ThreadPool &pool, std::vector<Workspace<T>> &workspaces,
+                         T h, const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+            apply_gradients(reduce_gradients(pool, workspaces, inputs, outputs), h / batch_size);
+        }
+
+        //! Same as above, the step being made by optimizer from the
+        //! summed gradients.
+        void train_batch(ThreadPool &pool, std::vector<Workspace<T>> &workspaces,
+                         Optimizer<T> &optimizer, const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            const unsigned int batch_size = inputs.size2();
+            if (batch_size == 0 || layers.empty())
+                return;
+            FFNN_PROFILE_SCOPE(profile::Phase::train, -1, 0, 0, batch_size);
+            apply_gradients(reduce_gradients(pool, workspaces, inputs, outputs), optimizer,
+                            T(1) / batch_size);
+        }
+
+        //! Lock-free asynchronous (Hogwild) training. Each thread of pool
+        //! runs train(ws, h, input, output) on its share of the samples,
+        //! reading and updating the shared weights and biases directly,
+        //! without any synchronization. Threads can see partially updated
+        //! layers, which this scheme accepts since the updates are sparse
+        //! and small compared to the weights. workspaces is resized to
+        //! pool.size(), one per thread.
+        //!
+        //! This is a data race in the sense of the C++ memory model:
+        //! it relies on the loads and stores of T being indivisible,
+        //! as for float and double on x86, and isn't reproducible.
+        //! Use train or train_batch when that matters.
+        template<typename V>
+        void train_async(ThreadPool &pool, std::vector<Workspace<T>> &workspaces, T h,
+                         const std::vector<vector<T>> &inputs, const std::vector<V> &outputs)
+        {
+            const unsigned int threads = pool.size();
+            workspaces.resize(threads);
+            pool.run(threads, [&](unsigned int k) {
+                    for (unsigned int i = k; i < inputs.size(); i += threads)
+                        train(workspaces[k], h, inputs[i], outputs[i]);
+                });
+        }
+
+        //! Same as above, with one sample per column of inputs and outputs.
+        void train_async(ThreadPool &pool, std::vector<Workspace<T>> &workspaces, T h,
+                         const matrix<T> &inputs, const matrix<T> &outputs)
+        {
+            const unsigned int threads = pool.size();
+            workspaces.resize(threads);
+            pool.run(threads, [&](unsigned int k) {
+                    for (unsigned int j = k; j < inputs.size2(); j += threads)
+                        train(workspaces[k], h, column(inputs, j), column(outputs, j));
+                });
+        }
+
+        //! Compute the gradients of the cost over the weights and the
+        //! biases, summed over the samples of the batch, into
+        //! ws.weight_gradients and ws.bias_gradients.
+        //! Doesn't allocate if ws is already sized for this network and
+        //! batch size.
+        template<class E1, class E2>
+        void compute_gradients(Workspace<T> &ws, const matrix_expression<E1> &inputs,
+                               const matrix_expression<E2> &outputs) const
+        {
+            forward_batch(ws, inputs);
+            backward_batch(ws, outputs);
+            batch_gradients(ws, 0);
+        }
+
+        //! Same as above, keeping only the activations of the
+        //! checkpoints of plan during the forward pass, and
+        //! recomputing the other ones segment by segment during the
+        //! backward pass, see CheckpointPlan. The gradients of a layer
+        //! are computed as soon as its deltas are, which are then only
+        //! kept until the deltas of the layer before. The gradients
+        //! are the same as above, bit for bit.
+        //! plan must have been made for this network by
+        //! plan_checkpoints. Doesn't allocate if ws is already sized
+        //! for this network, plan and batch size.
+        void compute_gradients(Workspace<T> &ws, const CheckpointPlan &plan,
+                               const matrix<T> &inputs, const matrix<T> &outputs) const
+        {
+            const unsigned int batch_size = inputs.size2();
+            const unsigned int L = layers.size();
+            ws.resize(layers, batch_size, plan);
+            if (L == 0)
+                return;
+            T *buffer = ws.checkpoint_buffer.data();
+            auto activation = [&](unsigned int i) {return buffer + plan.offsets[i] * batch_size;};
+
+            std::copy(inputs.data().begin(), inputs.data().end(), activation(0));
+            for (unsigned int i = 0; i < L; i++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::forward, i, product_flops(layers[i], batch_size),
+                                   product_bytes(layers[i], batch_size));
+                layers[i].forward(activation(i), activation(i + 1), batch_size);
+            }
+
+            // delta is dC_over_dz of the layer being handled, and
+            // previous receives the one of the layer before.
+            T *delta = buffer + plan.delta_offsets[0] * batch_size;
+            T *previous = buffer + plan.delta_offsets[1] * batch_size;
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::backward, L - 1, 0, 0);
+                const std::size_t n = std::size_t(layers[L - 1].get_output_size()) * batch_size;
+                const T *a = activation(L);
+                const T *y = outputs.data().begin();
+                for (std::size_t k = 0; k < n; k++)
+                    delta[k] = a[k] - y[k];
+                layers[L - 1].derivative_mask(delta, a, batch_size);
+            }
+            const unsigned int segments = plan.checkpoints.size();
+            for (unsigned int j = segments; j-- > 0;)
+            {
+                const unsigned int first = plan.checkpoints[j];
+                const unsigned int end = j + 1 < segments ? plan.checkpoints[j + 1] : L;
+                // The last segment is still there from the forward pass.
+                if (j + 1 < segments)
+                    for (unsigned int i = first; i + 1 < end; i++)
+                    {
+                        FFNN_PROFILE_SCOPE(profile::Phase::forward, i, product_flops(layers[i], batch_size),
+                                           product_bytes(layers[i], batch_size));
+                        layers[i].forward(activation(i), activation(i + 1), batch_size);
+                    }
+
+                for (unsigned int l = end; l-- > first;)
+                {
+                    {
+                        FFNN_PROFILE_SCOPE(profile::Phase::gradients, l, product_flops(layers[l], batch_size),
+                                           product_bytes(layers[l], batch_size));
+                        matrix<T> &g = ws.weight_gradients[l];
+                        vector<T> &b = ws.bias_gradients[l];
+                        for (unsigned int i = 0; i < g.size1(); i++)
+                        {
+                            T sum = 0;
+                            for (unsigned int k = 0; k < batch_size; k++)
+                                sum += delta[std::size_t(i) * batch_size + k];
+                            b(i) = sum;
+                        }
+                        gemm::multiply(g.size1(), g.size2(), batch_size,
+                                       gemm::row_major(delta, batch_size),
+                                       gemm::row_major(activation(l), batch_size).trans(),
+                                       g.data().begin(), g.size2());
+                    }
+                    if (l == 0)
+                        break;
+
+                    FFNN_PROFILE_SCOPE(profile::Phase::backward, l - 1, product_flops(layers[l], batch_size),
+                                       product_bytes(layers[l], batch_size));
+                    const matrix<T> &w = layers[l].weights;
+                    gemm::multiply(w.size2(), batch_size, w.size1(),
+                                   gemm::row_major(w.data().begin(), w.size2()).trans(),
+                                   gemm::row_major(delta, batch_size), previous, batch_size);
+                    layers[l - 1].derivative_mask(previous, activation(l), batch_size);
+                    std::swap(delta, previous);
+                }
+            }
+        }
+
+        //! Move each layer by -rate times the gradients stored in ws.
+        void apply_gradients(const Workspace<T> &ws, T rate)
+        {
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l, product_flops(layers[l], 1),
+                                   update_bytes(layers[l]));
+                noalias(layers[l].weights) -= rate * ws.weight_gradients[l];
+                noalias(layers[l].biases) -= rate * ws.bias_gradients[l];
+            }
+        }
 
-            // Reverse order (right -> left) browsing of a_vec and delta_list.
-            // We throw the last vector of a_vec and the first vector of delta_list.
-            a_vec_it = ++a_vec.rbegin();
-            auto delta_it = delta_list.begin();
-            for (auto &l : boost::adaptors::reverse(layers))
+        //! Make a step of optimizer for the gradients stored in ws,
+        //! times scale.
+        void apply_gradients(const Workspace<T> &ws, Optimizer<T> &optimizer, T scale)
+        {
+            optimizer.prepare(layers);
+            optimizer.begin_update();
+            for (unsigned int l = 0; l < layers.size(); l++)
             {
-                auto m = outer_prod(*delta_it, *a_vec_it);
+                FFNN_PROFILE_SCOPE(profile::Phase::update, l, product_flops(layers[l], 1),
+                                   update_bytes(layers[l]));
+                const matrix<T> &g = ws.weight_gradients[l];
+                optimizer.update(l, 0, g.data().size(), layers[l].weights.data().begin(),
+                                 g.data().begin(), scale);
+                optimizer.update(l, g.data().size(), layers[l].biases.size(),
+                                 layers[l].biases.data().begin(),
+                                 ws.bias_gradients[l].data().begin(), scale);
+            }
+        }
 
-                // Update with the gradient
-                l.weights -= h * m;
-                l.biases -= h * (*delta_it);
+        //! Evaluate the network on a batch of samples, one per column
+        //! of inputs, the same column of outputs being the expected
+        //! result, and add them to result. The outputs of the network
+        //! are only read once, by a single pass computing the
+        //! predictions, the expected classes and the loss together.
+        //! If result was made for another number of classes, it is
+        //! reset to Evaluation(classes) first: counts of two models
+        //! with different outputs can't be added.
+        //! Doesn't allocate if ws is already sized for this network
+        //! and batch size, and result for its number of outputs.
+        template<class E1, class E2>
+        void evaluate(Workspace<T> &ws, const matrix_expression<E1> &inputs,
+                      const matrix_expression<E2> &outputs, Evaluation &result) const
+        {
+            if (layers.empty())
+                return;
+            const unsigned int classes = layers.back().get_output_size();
+            if (result.confusion.size1() != classes)
+                result = Evaluation(classes);
+            forward_batch(ws, inputs);
 
-                a_vec_it++;
-                delta_it++;
+            const matrix<T> &a = ws.batch_activations.back();
+            const E2 &y = outputs();
+            const unsigned int batch_size = a.size2();
+            for (unsigned int j = 0; j < batch_size; j++)
+            {
+                unsigned int predicted = 0, expected = 0;
+                T loss = 0;
+                for (unsigned int i = 0; i < classes; i++)
+                {
+                    const T ai = a(i, j), yi = y(i, j);
+                    loss += (ai - yi) * (ai - yi);
+                    if (ai > a(predicted, j))
+                        predicted = i;
+                    if (yi > y(expected, j))
+                        expected = i;
+                }
+                result.loss += loss / 2;
+                result.correct += predicted == expected;
+                result.confusion(expected, predicted)++;
             }
+            result.samples += batch_size;
+        }
+
+        //! Parallel version of the above, for a whole set. The samples
+        //! are evaluated by batches of batch_size columns, spread over
+        //! the threads of pool, the batches being run by the shard k
+        //! using workspaces[k]. The results of the batches are summed
+        //! in order, so they don't depend on the number of threads.
+        //! result is reset as by the single batch version.
+        void evaluate(ThreadPool &pool, std::vector<Workspace<T>> &workspaces,
+                      const matrix<T> &inputs, const matrix<T> &outputs, Evaluation &result,
+                      unsigned int batch_size = 256) const
+        {
+            const unsigned int n = inputs.size2();
+            if (n == 0 || layers.empty())
+                return;
+
+            batch_size = std::max(batch_size, 1u);
+            const unsigned int batches = (n + batch_size - 1) / batch_size;
+            const unsigned int shards = std::min(pool.size(), batches);
+            workspaces.resize(std::max<std::size_t>(workspaces.size(), shards));
+            const unsigned int classes = layers.back().get_output_size();
+            if (result.confusion.size1() != classes)
+                result = Evaluation(classes);
+            std::vector<Evaluation> partial(batches, Evaluation(classes));
+            pool.run(shards, [&](unsigned int k) {
+                    for (unsigned int b = k; b < batches; b += shards)
+                    {
+                        const unsigned int first = b * batch_size;
+                        const unsigned int last = std::min(n, first + batch_size);
+                        evaluate(workspaces[k], subrange(inputs, 0, inputs.size1(), first, last),
+                                 subrange(outputs, 0, outputs.size1(), first, last), partial[b]);
+                    }
+                });
+            for (const auto &p : partial)
+                result += p;
         }
 
         friend
@@ -133,21 +723,49 @@ namespace ffnn
             return oss;
         }
 
-        boost::property_tree::ptree serialize()
+        boost::property_tree::ptree serialize() const
         {
             boost::property_tree::ptree root;
 
-            for (auto l : layers)
+            for (const auto &l : layers)
                 root.add_child("network.layers.layer", l.serialize());
 
             return root;
         }
 
-        void save_file(std::string filename)
+        //! Streaming version of serialize(), writing the same JSON
+        //! schema to os without building a property tree.
+        void serialize(std::ostream &os) const
         {
+            json::Writer w(os);
+            w.begin_object();
+            w.key("network");
+            w.begin_object();
+            w.key("layers");
+            w.begin_object();
+            for (const auto &l : layers)
+            {
+                w.key("layer");
+                l.serialize(w);
+            }
+            w.end_object();
+            w.end_object();
+            w.end_object();
+        }
+
+        //! Write the network as JSON, in the format read by load_file.
+        //! \return false if it couldn't be written, or if a layer has
+        //!         a custom activation, which load_file couldn't read
+        //!         back: nothing is written then.
+        bool save_file(std::string filename) const
+        {
+            for (const auto &layer : layers)
+                if (layer.activation == ActivationId::custom)
+                    return false;
             std::ofstream ofs(filename);
-            boost::property_tree::write_json(ofs, serialize());
+            serialize(ofs);
             ofs << "\n";
+            return ofs.good();
         }
 
         bool load(const boost::property_tree::ptree &tree)
@@ -176,19 +794,304 @@ namespace ffnn
             return true;
         }
 
-        void load_file(std::string filename)
+        //! Streaming version of load(ptree), reading the JSON written
+        //! by serialize() or by write_json(serialize()) from is.
+        bool load(std::istream &is)
         {
-            namespace pt = boost::property_tree;
+            layers.resize(0);
+
+            json::Reader r(is);
+            std::string key;
+            bool ok = r.begin_object();
+            while (ok && r.next_key(key))
+            {
+                if (key != "network")
+                {
+                    ok = r.skip_value();
+                    continue;
+                }
+                ok = r.begin_object();
+                while (ok && r.next_key(key))
+                {
+                    if (key != "layers")
+                    {
+                        ok = r.skip_value();
+                        continue;
+                    }
+                    ok = r.begin_object();
+                    while (ok && r.next_key(key))
+                    {
+                        Layer<T> layer;
+                        ok = key == "layer" && layer.load(r)
+                            && connect_layer(std::move(layer));
+                    }
+                }
+            }
 
-            pt::ptree tree;
+            if (!ok || !r.good())
+            {
+                layers.resize(0);
+                return false;
+            }
+            return true;
+        }
 
+        bool load_file(std::string filename)
+        {
             std::ifstream ifs(filename);
-            pt::read_json(ifs, tree);
+            return load(ifs);
+        }
+
+        //! Write the network in the binary format of BinaryFormat.hpp.
+        //! \return false if a layer uses a custom activation, T has no
+        //!         binary representation, or the file can't be written.
+        bool save_binary(std::string filename) const
+        {
+            if (binary::scalar_code<T>() == 0)
+                return false;
 
-            load(tree);
+            binary::Header header;
+            std::memcpy(header.magic, binary::magic, sizeof(header.magic));
+            header.version = binary::version;
+            header.byte_order = binary::byte_order;
+            header.scalar = binary::scalar_code<T>();
+            header.layer_count = layers.size();
+
+            std::vector<binary::LayerEntry> entries(layers.size());
+            std::uint64_t offset = sizeof(header) + entries.size() * sizeof(binary::LayerEntry);
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                const Layer<T> &layer = layers[l];
+                if (layer.activation == ActivationId::custom)
+                    return false;
+                binary::LayerEntry &e = entries[l];
+                e.input_size = layer.get_input_size();
+                e.output_size = layer.get_output_size();
+                e.activation = static_cast<std::uint32_t>(layer.activation);
+                e.reserved = 0;
+                e.weights_offset = binary::align(offset);
+                e.biases_offset = binary::align(e.weights_offset + layer.weights.data().size() * sizeof(T));
+                offset = e.biases_offset + layer.biases.size() * sizeof(T);
+            }
+
+            std::ofstream ofs(filename, std::ios::binary);
+            ofs.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            ofs.write(reinterpret_cast<const char *>(entries.data()),
+                      entries.size() * sizeof(binary::LayerEntry));
+            std::uint64_t position = sizeof(header) + entries.size() * sizeof(binary::LayerEntry);
+            auto write_blob = [&](std::uint64_t at, const T *blob, std::size_t count) {
+                static const char padding[binary::blob_alignment] = {};
+                ofs.write(padding, at - position);
+                ofs.write(reinterpret_cast<const char *>(blob), count * sizeof(T));
+                position = at + count * sizeof(T);
+            };
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                write_blob(entries[l].weights_offset, &layers[l].weights.data()[0],
+                           layers[l].weights.data().size());
+                write_blob(entries[l].biases_offset, &layers[l].biases[0],
+                           layers[l].biases.size());
+            }
+            return ofs.good();
+        }
+
+        //! Replace the layers by the ones of a file written by
+        //! save_binary. To evaluate a model without copying its
+        //! weights, use MappedNetwork (MappedNetwork.hpp) instead.
+        //! \return false, with no layers, if the file isn't valid.
+        bool load_binary(std::string filename)
+        {
+            layers.resize(0);
+
+            std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+            if (!ifs)
+                return false;
+            const std::streamoff size = ifs.tellg();
+            if (size <= 0)
+                return false;
+            // Read as 64 bit words, for the alignment of the entries.
+            std::vector<std::uint64_t> buffer((size + 7) / 8);
+            const char *data = reinterpret_cast<const char *>(buffer.data());
+            ifs.seekg(0);
+            if (!ifs.read(reinterpret_cast<char *>(buffer.data()), size)
+                || !binary::check<T>(data, size))
+                return false;
+
+            const binary::Header &header = *reinterpret_cast<const binary::Header *>(data);
+            const binary::LayerEntry *entries
+                = reinterpret_cast<const binary::LayerEntry *>(data + sizeof(binary::Header));
+            for (unsigned int l = 0; l < header.layer_count; l++)
+            {
+                const binary::LayerEntry &e = entries[l];
+                const T *weights = reinterpret_cast<const T *>(data + e.weights_offset);
+                const T *biases = reinterpret_cast<const T *>(data + e.biases_offset);
+                Layer<T> layer;
+                layer.weights.resize(e.output_size, e.input_size, false);
+                layer.biases.resize(e.output_size, false);
+                layer.activation = static_cast<ActivationId>(e.activation);
+                std::copy(weights, weights + std::size_t(e.output_size) * e.input_size,
+                          layer.weights.data().begin());
+                std::copy(biases, biases + e.output_size, layer.biases.data().begin());
+                layers.push_back(std::move(layer));
+            }
+            return true;
         }
 
     private:
+        //! Compute the gradients of the batch on the threads of pool,
+        //! the shard k of consecutive columns into workspaces[k], and
+        //! sum them in shard order into workspaces[0], so the result
+        //! only depends on the number of threads.
+        //! \return workspaces[0].
+        const Workspace<T> &reduce_gradients(ThreadPool &pool, std::vector<Workspace<T>> &workspaces,
+                                             const matrix<T> &inputs, const matrix<T> &outputs) const
+        {
+            const unsigned int batch_size = inputs.size2();
+            const unsigned int shards = pool.size();
+            workspaces.resize(shards);
+            pool.run(shards, [&](unsigned int k) {
+                    const unsigned int first = k * batch_size / shards;
+                    const unsigned int last = (k + 1) * batch_size / shards;
+                    compute_gradients(workspaces[k],
+                                      subrange(inputs, 0, inputs.size1(), first, last),
+                                      subrange(outputs, 0, outputs.size1(), first, last));
+                });
+
+            Workspace<T> &sum = workspaces[0];
+            for (unsigned int k = 1; k < shards; k++)
+            {
+                for (unsigned int l = 0; l < layers.size(); l++)
+                {
+                    noalias(sum.weight_gradients[l]) += workspaces[k].weight_gradients[l];
+                    noalias(sum.bias_gradients[l]) += workspaces[k].bias_gradients[l];
+                }
+            }
+            return sum;
+        }
+
+        //! Compute ws.deltas from ws.activations, set by forward().
+        template<class E>
+        void backward(Workspace<T> &ws, const vector_expression<E> &output) const
+        {
+            /////////////
+            // Compute the delta list, wich is the list of all derivative
+            // dC_over_dz where z_l is the weightenen sum of an input incoming
+            // into the layer l.
+
+            // L means the last layer, and l a layer beetween 1(input) and L.
+            // dC_over_da means the gradient of C on the direction a.
+            const unsigned int L = layers.size();
+            auto &a_vec = ws.activations;
+            auto &delta_list = ws.deltas;
+
+            //Delta L :
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::backward, L - 1, 0, 0);
+                noalias(delta_list[L]) = a_vec[L] - output;
+                layers[L - 1].derivative_mask(delta_list[L], a_vec[L]);
+            }
+            for (unsigned int l = L - 1; l > 0; l--)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::backward, l - 1, product_flops(layers[l], 1),
+                                   product_bytes(layers[l], 1));
+                const matrix<T> &w = layers[l].weights;
+                gemm::gemv_trans(w.size1(), w.size2(), w.data().begin(),
+                                 delta_list[l + 1].data().begin(), delta_list[l].data().begin());
+                layers[l - 1].derivative_mask(delta_list[l], a_vec[l]);
+            }
+        }
+
+        //! Batched version of backward(), computing ws.batch_deltas
+        //! from ws.batch_activations.
+        template<class E>
+        void backward_batch(Workspace<T> &ws, const matrix_expression<E> &outputs) const
+        {
+            const unsigned int batch_size = ws.batch_size;
+            auto &a_vec = ws.batch_activations;
+            auto &delta_list = ws.batch_deltas;
+
+            // Same as in backward(), but with one column per sample.
+            const unsigned int L = layers.size();
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::backward, L - 1, 0, 0);
+                noalias(delta_list[L]) = a_vec[L] - outputs;
+                layers[L - 1].derivative_mask(delta_list[L], a_vec[L]);
+            }
+            for (unsigned int l = L - 1; l > 0; l--)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::backward, l - 1, product_flops(layers[l], batch_size),
+                                   product_bytes(layers[l], batch_size));
+                const matrix<T> &w = layers[l].weights;
+                gemm::multiply(w.size2(), batch_size, w.size1(),
+                               gemm::row_major(w.data().begin(), w.size2()).trans(),
+                               gemm::row_major(delta_list[l + 1].data().begin(), batch_size),
+                               delta_list[l].data().begin(), batch_size);
+                layers[l - 1].derivative_mask(delta_list[l], a_vec[l]);
+            }
+        }
+
+        //! Compute ws.bias_gradients of all the layers, and
+        //! ws.weight_gradients of the layers from first on, from
+        //! the results of backward_batch().
+        void batch_gradients(Workspace<T> &ws, unsigned int first) const
+        {
+            const unsigned int batch_size = ws.batch_size;
+            auto &a_vec = ws.batch_activations;
+            auto &delta_list = ws.batch_deltas;
+
+            // Summing the columns of delta gives the gradient of the biases.
+            const scalar_vector<T> ones(batch_size, 1);
+            for (unsigned int l = 1; l <= layers.size(); l++)
+            {
+                FFNN_PROFILE_SCOPE(profile::Phase::gradients, l - 1,
+                                   l - 1 < first ? 0 : product_flops(layers[l - 1], batch_size),
+                                   l - 1 < first ? 0 : product_bytes(layers[l - 1], batch_size));
+                noalias(ws.bias_gradients[l - 1]) = prod(delta_list[l], ones);
+                if (l - 1 < first)
+                    continue;
+                matrix<T> &g = ws.weight_gradients[l - 1];
+                gemm::multiply(g.size1(), g.size2(), batch_size,
+                               gemm::row_major(delta_list[l].data().begin(), batch_size),
+                               gemm::row_major(a_vec[l - 1].data().begin(), batch_size).trans(),
+                               g.data().begin(), g.size2());
+            }
+        }
+
+        //! Floating point operations of the product of the weights
+        //! of layer with n samples, or of their transpose, for the
+        //! profiler.
+        static std::uint64_t product_flops(const Layer<T> &layer, std::uint64_t n)
+        {
+            return 2 * n * layer.get_input_size() * layer.get_output_size();
+        }
+
+        //! Bytes read and written by the same product: the weights
+        //! once, the inputs and the outputs.
+        static std::uint64_t product_bytes(const Layer<T> &layer, std::uint64_t n)
+        {
+            return sizeof(T) * (std::uint64_t(layer.get_input_size()) * layer.get_output_size()
+                                + n * (layer.get_input_size() + layer.get_output_size()));
+        }
+
+        //! Same as above for a sparse input of nnz nonzeros, only the
+        //! matching columns of the weights being read.
+        static std::uint64_t sparse_flops(const Layer<T> &layer, std::uint64_t nnz)
+        {
+            return 2 * nnz * layer.get_output_size();
+        }
+
+        static std::uint64_t sparse_bytes(const Layer<T> &layer, std::uint64_t nnz)
+        {
+            return sizeof(T) * (nnz * layer.get_output_size() + 2 * nnz + layer.get_output_size());
+        }
+
+        //! Bytes of an update of layer: its weights and biases read
+        //! and written.
+        static std::uint64_t update_bytes(const Layer<T> &layer)
+        {
+            return 2 * sizeof(T) * (std::uint64_t(layer.get_input_size()) + 1) * layer.get_output_size();
+        }
+
         layer_list layers;
     };
 }
@@ -0,0 +1,270 @@
+#ifndef OPTIMIZER_HPP_
+#define OPTIMIZER_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "Simd.hpp"
+
+namespace ffnn
+{
+    template<typename T>
+    class Layer;
+
+    /**
+     * Update rule of the weights and biases of a Network, given to
+     * Network::train, train_batch and apply_gradients in place of a
+     * learning rate.
+     *
+     * The parameters of layer l are numbered as stored: the weights
+     * row after row, then the biases. The network hands them to the
+     * optimizer by runs of consecutive parameters, with their
+     * gradient either as an array or as a row d * a of the outer
+     * product of the per-sample training: the gradient and the step
+     * are computed in the same loop over the parameters, without
+     * storing the gradient of the whole layer.
+     *
+     * An optimizer keeps a state per parameter (the velocities, the
+     * moments), sized for the network on its first update and reset
+     * when the topology changes. It must only be used for one network.
+     */
+    template<typename T>
+    class Optimizer
+    {
+    public:
+        virtual ~Optimizer() {};
+
+        //! Size the state for layers, zeroing it if it changes.
+        void prepare(const std::vector<Layer<T>> &layers)
+        {
+            bool same = sizes.size() == layers.size();
+            for (unsigned int l = 0; same && l < layers.size(); l++)
+                same = sizes[l] == parameter_count(layers[l]);
+            if (same)
+                return;
+
+            sizes.resize(layers.size());
+            for (unsigned int l = 0; l < layers.size(); l++)
+                sizes[l] = parameter_count(layers[l]);
+            states.assign(slots * layers.size(), std::vector<T>());
+            for (unsigned int s = 0; s < slots; s++)
+                for (unsigned int l = 0; l < layers.size(); l++)
+                    states[s * layers.size() + l].assign(sizes[l], T(0));
+            reset();
+        }
+
+        //! Called once per update of the network, before the calls
+        //! to update() and update_outer() for its layers.
+        virtual void begin_update() {};
+
+        //! Move the n parameters p of layer, starting at offset, for
+        //! the gradient scale * g.
+        virtual void update(unsigned int layer, std::size_t offset, std::size_t n,
+                            T *p, const T *g, T scale) = 0;
+
+        //! Same as above for the gradient d * a, a row of the outer
+        //! product of the deltas and the inputs of a layer.
+        virtual void update_outer(unsigned int layer, std::size_t offset, std::size_t n,
+                                  T *p, T d, const T *a) = 0;
+
+    protected:
+        //! \param slots Number of state values per parameter.
+        explicit Optimizer(unsigned int slots)
+            :slots(slots)
+        {};
+
+        //! Called when the state has been zeroed.
+        virtual void reset() {};
+
+        //! The state slot of the parameters of layer.
+        T *state(unsigned int slot, unsigned int layer)
+        {
+            return states[slot * sizes.size() + layer].data();
+        }
+
+    private:
+        static std::size_t parameter_count(const Layer<T> &layer)
+        {
+            return std::size_t(layer.get_input_size() + 1) * layer.get_output_size();
+        }
+
+        const unsigned int slots;
+        //! Number of parameters of each layer.
+        std::vector<std::size_t> sizes;
+        //! The slot s of layer l is states[s * layer count + l].
+        std::vector<std::vector<T>> states;
+    };
+
+    namespace detail
+    {
+        //! Implement update() and update_outer() with the member
+        //! template step(layer, offset, n, p, g) of D, g(j) being the
+        //! gradient of p[j]: both are a single loop with the
+        //! gradient computed inline.
+        template<typename T, class D>
+        class OptimizerKernel : public Optimizer<T>
+        {
+        public:
+            void update(unsigned int layer, std::size_t offset, std::size_t n,
+                        T *p, const T *g, T scale) override
+            {
+                static_cast<D *>(this)->step(layer, offset, n, p, [=](std::size_t j) {
+                        return scale * g[j];
+                    });
+            }
+
+            void update_outer(unsigned int layer, std::size_t offset, std::size_t n,
+                              T *p, T d, const T *a) override
+            {
+                static_cast<D *>(this)->step(layer, offset, n, p, [=](std::size_t j) {
+                        return d * a[j];
+                    });
+            }
+
+        protected:
+            explicit OptimizerKernel(unsigned int slots)
+                :Optimizer<T>(slots)
+            {};
+        };
+    }
+
+    //! Plain gradient descent, p -= rate g, as Network::train(h, ...).
+    template<typename T>
+    class Sgd : public detail::OptimizerKernel<T, Sgd<T>>
+    {
+    public:
+        explicit Sgd(T rate)
+            :detail::OptimizerKernel<T, Sgd<T>>(0), rate(rate)
+        {};
+
+        template<class G>
+        void step(unsigned int, std::size_t, std::size_t n, T *p, G g)
+        {
+            for (std::size_t j = 0; j < n; j++)
+                p[j] -= rate * g(j);
+        }
+
+        T rate;
+    };
+
+    //! Gradient descent with momentum: v = mu v - rate g, p += v.
+    template<typename T>
+    class Momentum : public detail::OptimizerKernel<T, Momentum<T>>
+    {
+    public:
+        Momentum(T rate, T mu = 0.9)
+            :detail::OptimizerKernel<T, Momentum<T>>(1), rate(rate), mu(mu)
+        {};
+
+        template<class G>
+        void step(unsigned int layer, std::size_t offset, std::size_t n, T *p, G g)
+        {
+            T *v = this->state(0, layer) + offset;
+            for (std::size_t j = 0; j < n; j++)
+            {
+                v[j] = mu * v[j] - rate * g(j);
+                p[j] += v[j];
+            }
+        }
+
+        T rate;
+        T mu;
+    };
+
+    //! Nesterov momentum, with the gradient taken at the current
+    //! parameters: v = mu v - rate g, p += mu v - rate g.
+    template<typename T>
+    class Nesterov : public detail::OptimizerKernel<T, Nesterov<T>>
+    {
+    public:
+        Nesterov(T rate, T mu = 0.9)
+            :detail::OptimizerKernel<T, Nesterov<T>>(1), rate(rate), mu(mu)
+        {};
+
+        template<class G>
+        void step(unsigned int layer, std::size_t offset, std::size_t n, T *p, G g)
+        {
+            T *v = this->state(0, layer) + offset;
+            for (std::size_t j = 0; j < n; j++)
+            {
+                const T descent = rate * g(j);
+                v[j] = mu * v[j] - descent;
+                p[j] += mu * v[j] - descent;
+            }
+        }
+
+        T rate;
+        T mu;
+    };
+
+    //! Adam: moving averages m and v of the gradient and of its
+    //! square, and p -= rate m / (sqrt(v) + epsilon) with the bias
+    //! of the averages corrected.
+    template<typename T>
+    class Adam : public detail::OptimizerKernel<T, Adam<T>>
+    {
+    public:
+        Adam(T rate = 0.001, T beta1 = 0.9, T beta2 = 0.999, T epsilon = 1e-8)
+            :detail::OptimizerKernel<T, Adam<T>>(2),
+             rate(rate), beta1(beta1), beta2(beta2), epsilon(epsilon),
+             t(0), corrected_rate(0), corrected_epsilon(0)
+        {};
+
+        void begin_update() override
+        {
+            t++;
+            const T c1 = 1 - std::pow(beta1, T(t));
+            const T c2 = std::sqrt(1 - std::pow(beta2, T(t)));
+            // rate m / c1 / (sqrt(v) / c2 + epsilon), with one
+            // division less per parameter.
+            corrected_rate = rate * c2 / c1;
+            corrected_epsilon = epsilon * c2;
+        }
+
+        //! The parameters are updated by chunks, the square roots of
+        //! a chunk being computed by simd::sqrt between the update of
+        //! the moments and the one of the parameters.
+        template<class G>
+        void step(unsigned int layer, std::size_t offset, std::size_t n, T *p, G g)
+        {
+            T *m = this->state(0, layer) + offset;
+            T *v = this->state(1, layer) + offset;
+            const std::size_t chunk = 256;
+            T root[chunk];
+            for (std::size_t c = 0; c < n; c += chunk)
+            {
+                const std::size_t k = std::min(chunk, n - c);
+                for (std::size_t j = c; j < c + k; j++)
+                {
+                    const T gj = g(j);
+                    m[j] = beta1 * m[j] + (1 - beta1) * gj;
+                    v[j] = beta2 * v[j] + (1 - beta2) * gj * gj;
+                }
+                std::copy(v + c, v + c + k, root);
+                simd::sqrt(root, k);
+                for (std::size_t j = 0; j < k; j++)
+                    p[c + j] -= corrected_rate * m[c + j] / (root[j] + corrected_epsilon);
+            }
+        }
+
+        T rate;
+        T beta1;
+        T beta2;
+        T epsilon;
+
+    protected:
+        void reset() override
+        {
+            t = 0;
+        }
+
+    private:
+        //! Number of updates made.
+        unsigned long t;
+        T corrected_rate;
+        T corrected_epsilon;
+    };
+}
+
+#endif /* !OPTIMIZER_HPP_ */
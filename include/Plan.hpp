@@ -0,0 +1,247 @@
+#ifndef PLAN_HPP_
+#define PLAN_HPP_
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "Network.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    namespace detail
+    {
+        //! out[r] = sum of w[j * rows + r] * x[j] over the columns j,
+        //! for the rows r of a packed panel. The rows are independent
+        //! accumulators, so each column is a few vector multiply-adds.
+        template<unsigned int rows, typename T>
+        void panel_gemv(std::size_t cols, const T *w, const T *x, T *out, std::false_type)
+        {
+            T acc[rows] = {};
+            for (std::size_t j = 0; j < cols; j++, w += rows)
+            {
+                const T xj = x[j];
+                for (unsigned int r = 0; r < rows; r++)
+                    acc[r] += w[r] * xj;
+            }
+            std::copy(acc, acc + rows, out);
+        }
+
+#if defined(__GNUC__)
+        //! Same as above with vector registers, as in gemm::detail::kernel.
+        template<unsigned int rows, typename T>
+        void panel_gemv(std::size_t cols, const T *w, const T *x, T *out, std::true_type)
+        {
+            const unsigned int nr = gemm::nr<T>();
+            typedef T row __attribute__((vector_size(sizeof(T) * nr)));
+            row acc[rows / nr];
+            for (unsigned int k = 0; k < rows / nr; k++)
+                acc[k] = row{};
+            for (std::size_t j = 0; j < cols; j++, w += rows)
+            {
+                const T xj = x[j];
+                for (unsigned int k = 0; k < rows / nr; k++)
+                {
+                    row wk;
+                    std::memcpy(&wk, w + k * nr, sizeof(wk));
+                    acc[k] += wk * xj;
+                }
+            }
+            std::memcpy(out, acc, sizeof(acc));
+        }
+#endif
+    }
+
+    /**
+     * Inference only version of a Network<T>, compiled for the
+     * evaluation of one sample at a time.
+     *
+     * Each layer gets a kernel chosen for its shape when the plan is
+     * compiled:
+     *  - panels: the weights are packed by panels of
+     *    panel_rows() rows, stored column after column, so that a
+     *    panel is computed by vector multiply-adds without any
+     *    horizontal sum. The biases and the activation are applied
+     *    to each panel right after it is computed, while it is
+     *    still in the cache (softmax, which needs the whole layer,
+     *    being applied at the end).
+     *  - rows: the weights stay row major and use gemm::gemv, for
+     *    the layers with too few outputs to fill a panel.
+     *
+     * The layers write into two buffers used in turn, sized once for
+     * the widest layer. A plan is read only once compiled, and can
+     * be used by several threads, each with its own Scratch.
+     *
+     * The results are the ones of Network::eval, the sums being
+     * done in another order. Only the layers using one of the
+     * activations of Activation.hpp are supported, not custom ones.
+     */
+    template<typename T>
+    class Plan
+    {
+    public:
+        //! Buffers used by eval, to not allocate at each call.
+        struct Scratch
+        {
+            std::vector<T> buffers[2];
+            vector<T> output;
+        };
+
+        enum class Kernel : unsigned char
+        {
+            panels,
+            rows
+        };
+
+        Plan()
+            :width(0)
+        {};
+        explicit Plan(const Network<T> &net)
+            :width(0)
+        {
+            compile(net);
+        };
+
+        //! Rows of the weight panels, eight vector registers of T.
+        static constexpr unsigned int panel_rows() {return 8 * gemm::nr<T>();};
+
+        //! Build the plan of net, which can then change or be
+        //! destroyed without affecting the plan.
+        //! \return false, with an empty plan, if a layer has a
+        //!         custom activation.
+        bool compile(const Network<T> &net)
+        {
+            const auto &src = net.get_layers();
+            steps.clear();
+            width = 0;
+            for (const auto &layer : src)
+                if (layer.get_activation() == ActivationId::custom)
+                    return false;
+
+            const unsigned int p = panel_rows();
+            steps.resize(src.size());
+            for (unsigned int l = 0; l < src.size(); l++)
+            {
+                Step &s = steps[l];
+                const matrix<T> &w = src[l].get_weights();
+                s.rows = w.size1();
+                s.cols = w.size2();
+                s.activation = src[l].get_activation();
+                s.kernel = s.rows >= p / 2 ? Kernel::panels : Kernel::rows;
+                s.biases.assign(src[l].get_biases().begin(), src[l].get_biases().end());
+                if (s.kernel == Kernel::rows)
+                    s.weights.assign(w.data().begin(), w.data().end());
+                else
+                {
+                    // The last panel is padded with zero rows.
+                    const std::size_t panels = (s.rows + p - 1) / p;
+                    s.weights.assign(panels * p * s.cols, T(0));
+                    T *packed = s.weights.data();
+                    for (std::size_t q = 0; q < panels; q++)
+                        for (unsigned int j = 0; j < s.cols; j++)
+                            for (unsigned int r = 0; r < p; r++, packed++)
+                                if (q * p + r < s.rows)
+                                    *packed = w(q * p + r, j);
+                }
+                width = std::max(width, s.rows);
+            }
+            return true;
+        }
+
+        bool empty() const {return steps.empty();};
+        unsigned int layer_count() const {return steps.size();};
+        Kernel get_kernel(unsigned int l) const {return steps[l].kernel;};
+
+        //! Evaluate the network, like Network::eval.
+        vector<T> operator() (const vector<T> &input) const
+        {
+            Scratch s;
+            return (*this)(s, input);
+        }
+
+        //! Evaluate the network using the buffers of s.
+        //! \return A reference to the output, stored inside s.
+        const vector<T> &operator() (Scratch &s, const vector<T> &input) const
+        {
+            if (steps.empty())
+            {
+                s.output = input;
+                return s.output;
+            }
+            for (auto &b : s.buffers)
+                if (b.size() < width)
+                    b.resize(width);
+            if (s.output.size() != steps.back().rows)
+                s.output.resize(steps.back().rows, false);
+
+            const T *in = &input[0];
+            for (unsigned int l = 0; l < steps.size(); l++)
+            {
+                T *out = l + 1 == steps.size() ? &s.output[0] : s.buffers[l % 2].data();
+                run(steps[l], in, out);
+                in = out;
+            }
+            return s.output;
+        }
+
+    private:
+        struct Step
+        {
+            unsigned int rows;
+            unsigned int cols;
+            ActivationId activation;
+            Kernel kernel;
+            //! Row major, or by panels for Kernel::panels.
+            std::vector<T> weights;
+            std::vector<T> biases;
+        };
+
+        //! Compute the layer of s for in into out.
+        static void run(const Step &s, const T *in, T *out)
+        {
+            if (s.kernel == Kernel::rows)
+            {
+                gemm::gemv(s.rows, s.cols, s.weights.data(), in, out);
+                activate(s.activation, out, s.biases.data(), s.rows, 1);
+                return;
+            }
+
+            const unsigned int p = panel_rows();
+            const bool whole = s.activation == ActivationId::softmax;
+            const T *w = s.weights.data();
+            T tile[panel_rows()];
+            for (unsigned int r = 0; r < s.rows; r += p, w += std::size_t(p) * s.cols)
+            {
+                const unsigned int n = std::min(p, s.rows - r);
+                // Only the last panel can be partial, and is computed
+                // in tile not to write past the end of out.
+                T *panel = n == p ? out + r : tile;
+                detail::panel_gemv<panel_rows()>(s.cols, w, in, panel,
+                                                 gemm::detail::vectorizable<T>());
+                if (n != p)
+                    std::copy(panel, panel + n, out + r);
+                if (!whole)
+                    activate(s.activation, out + r, s.biases.data() + r, n, 1);
+            }
+            if (whole)
+                activate(s.activation, out, s.biases.data(), s.rows, 1);
+        }
+
+        std::vector<Step> steps;
+        //! Largest number of outputs of a layer.
+        unsigned int width;
+    };
+
+    //! Compile net into a Plan, which is empty if net has a layer
+    //! with a custom activation.
+    template<typename T>
+    Plan<T> compile(const Network<T> &net)
+    {
+        return Plan<T>(net);
+    }
+}
+
+#endif /* !PLAN_HPP_ */
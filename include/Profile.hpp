@@ -0,0 +1,330 @@
+#ifndef PROFILE_HPP_
+#define PROFILE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "JsonStream.hpp"
+
+namespace ffnn
+{
+    /**
+     * Instrumentation of the training and inference hot paths.
+     *
+     * Network times each phase of each layer with a Scope, counting
+     * the floating point operations and the bytes it moves, and
+     * Workspace counts the allocations of its buffers. The events
+     * go to the global profiler(), which sums them per phase and
+     * layer, passes them to the observers and keeps the first ones
+     * for write_trace().
+     *
+     * All of this is only compiled in with FFNN_PROFILE defined:
+     * otherwise the FFNN_PROFILE_ macros expand to nothing, their
+     * arguments not even being evaluated.
+     */
+    namespace profile
+    {
+        typedef std::chrono::steady_clock clock;
+
+        //! What a scope is timing.
+        enum class Phase : unsigned char
+        {
+            //! A whole train() or train_batch() call.
+            train,
+            //! The product of a layer with its input, and its activation.
+            forward,
+            //! The backpropagation of the deltas through a layer.
+            backward,
+            //! The gradients of a layer, summed over a batch.
+            gradients,
+            //! The update of the weights and biases of a layer.
+            update
+        };
+
+        inline const char *phase_name(Phase phase)
+        {
+            switch (phase)
+            {
+            case Phase::train: return "train";
+            case Phase::forward: return "forward";
+            case Phase::backward: return "backward";
+            case Phase::gradients: return "gradients";
+            case Phase::update: return "update";
+            }
+            return "";
+        }
+
+        //! One timed scope.
+        struct Event
+        {
+            Phase phase;
+            //! Index of the layer, -1 for the whole network.
+            int layer;
+            clock::time_point start;
+            clock::duration duration;
+            std::uint64_t flops;
+            //! Bytes read and written, the weights included.
+            std::uint64_t bytes;
+            //! Samples trained on, for Phase::train.
+            std::uint64_t samples;
+            //! Threads are numbered in the order of their first event.
+            unsigned int thread;
+        };
+
+        //! The events of a phase and layer, summed.
+        struct Counter
+        {
+            std::uint64_t calls;
+            double seconds;
+            std::uint64_t flops;
+            std::uint64_t bytes;
+            std::uint64_t samples;
+        };
+
+        class Profiler
+        {
+        public:
+            typedef std::function<void(const Event &)> Observer;
+            typedef std::map<std::pair<Phase, int>, Counter> counter_map;
+
+            Profiler()
+                :trace_limit(100000)
+            {
+                reset();
+            };
+
+            //! Account for e, and pass it to the observers.
+            //! Can be called from any thread.
+            void record(Event e)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto t = threads.insert(std::make_pair(std::this_thread::get_id(),
+                                                       unsigned(threads.size())));
+                e.thread = t.first->second;
+
+                Counter &c = counters[std::make_pair(e.phase, e.layer)];
+                c.calls++;
+                c.seconds += std::chrono::duration<double>(e.duration).count();
+                c.flops += e.flops;
+                c.bytes += e.bytes;
+                c.samples += e.samples;
+                if (events.size() < trace_limit)
+                    events.push_back(e);
+                for (const auto &o : observers)
+                    o(e);
+            }
+
+            void count_allocation()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                allocations++;
+            }
+
+            //! Call observer on each event, from the thread of the
+            //! event and with the profiler locked: observer must not
+            //! call the profiler.
+            void add_observer(Observer observer)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                observers.push_back(std::move(observer));
+            }
+
+            void clear_observers()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                observers.clear();
+            }
+
+            //! Number of events kept for write_trace(), the later
+            //! ones being only counted.
+            void set_trace_limit(std::size_t limit)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                trace_limit = limit;
+            }
+
+            //! Forget the events, the counters and the allocations.
+            void reset()
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                counters.clear();
+                events.clear();
+                allocations = 0;
+                origin = clock::now();
+            }
+
+            //! The counters, by phase and layer.
+            counter_map get_counters() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return counters;
+            }
+
+            //! The counters of phase, summed over the layers.
+            Counter total(Phase phase) const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Counter sum = Counter();
+                for (const auto &c : counters)
+                    if (c.first.first == phase)
+                    {
+                        sum.calls += c.second.calls;
+                        sum.seconds += c.second.seconds;
+                        sum.flops += c.second.flops;
+                        sum.bytes += c.second.bytes;
+                        sum.samples += c.second.samples;
+                    }
+                return sum;
+            }
+
+            std::uint64_t allocation_count() const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                return allocations;
+            }
+
+            //! Samples trained per second spent in train() and
+            //! train_batch(), per thread for train_async().
+            double samples_per_second() const
+            {
+                const Counter c = total(Phase::train);
+                return c.seconds > 0 ? c.samples / c.seconds : 0;
+            }
+
+            //! Write the counters as JSON, with the time, flops and
+            //! bytes of each phase of each layer.
+            void write_json(std::ostream &os) const
+            {
+                const double rate = samples_per_second();
+                std::lock_guard<std::mutex> lock(mutex);
+                json::Writer w(os);
+                w.begin_object();
+                w.key("allocations");
+                w.value(allocations);
+                w.key("samples_per_second");
+                w.value(rate);
+                w.key("phases");
+                w.begin_array();
+                for (const auto &c : counters)
+                {
+                    const Counter &k = c.second;
+                    w.begin_object();
+                    w.key("phase");
+                    w.value(phase_name(c.first.first));
+                    w.key("layer");
+                    w.value(c.first.second);
+                    w.key("calls");
+                    w.value(k.calls);
+                    w.key("seconds");
+                    w.value(k.seconds);
+                    w.key("flops");
+                    w.value(k.flops);
+                    w.key("bytes");
+                    w.value(k.bytes);
+                    if (k.samples)
+                    {
+                        w.key("samples");
+                        w.value(k.samples);
+                    }
+                    w.key("gflops_per_second");
+                    w.value(k.seconds > 0 ? k.flops / k.seconds * 1e-9 : 0.);
+                    w.key("gbytes_per_second");
+                    w.value(k.seconds > 0 ? k.bytes / k.seconds * 1e-9 : 0.);
+                    w.end_object();
+                }
+                w.end_array();
+                w.end_object();
+                os << "\n";
+            }
+
+            //! Write the kept events in the Chrome trace event format,
+            //! to be opened in chrome://tracing or Perfetto.
+            void write_trace(std::ostream &os) const
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                os << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+                for (std::size_t i = 0; i < events.size(); i++)
+                {
+                    const Event &e = events[i];
+                    const double ts = std::chrono::duration<double, std::micro>(e.start - origin).count();
+                    const double dur = std::chrono::duration<double, std::micro>(e.duration).count();
+                    os << (i ? ",\n" : "\n") << "{\"name\": \"" << phase_name(e.phase);
+                    if (e.layer >= 0)
+                        os << " " << e.layer;
+                    os << "\", \"cat\": \"" << phase_name(e.phase) << "\", \"ph\": \"X\", \"ts\": "
+                       << ts << ", \"dur\": " << dur << ", \"pid\": 0, \"tid\": " << e.thread
+                       << ", \"args\": {\"flops\": " << e.flops << ", \"bytes\": " << e.bytes;
+                    if (e.samples)
+                        os << ", \"samples\": " << e.samples;
+                    os << "}}";
+                }
+                os << "\n]}\n";
+            }
+
+        private:
+            mutable std::mutex mutex;
+            counter_map counters;
+            std::vector<Event> events;
+            std::size_t trace_limit;
+            std::vector<Observer> observers;
+            std::map<std::thread::id, unsigned int> threads;
+            std::uint64_t allocations;
+            //! Time 0 of the trace.
+            clock::time_point origin;
+        };
+
+        //! The profiler the FFNN_PROFILE_ macros record into.
+        inline Profiler &profiler()
+        {
+            static Profiler p;
+            return p;
+        }
+
+        //! Times its lifetime and records it as an event.
+        class Scope
+        {
+        public:
+            Scope(Phase phase, int layer, std::uint64_t flops, std::uint64_t bytes,
+                  std::uint64_t samples = 0)
+            {
+                event.phase = phase;
+                event.layer = layer;
+                event.flops = flops;
+                event.bytes = bytes;
+                event.samples = samples;
+                event.start = clock::now();
+            };
+
+            ~Scope()
+            {
+                event.duration = clock::now() - event.start;
+                profiler().record(event);
+            };
+
+            Scope(const Scope &) = delete;
+            Scope &operator= (const Scope &) = delete;
+
+        private:
+            Event event;
+        };
+    }
+}
+
+#ifdef FFNN_PROFILE
+//! Time the rest of the enclosing block, the arguments being the
+//! ones of profile::Scope.
+#define FFNN_PROFILE_SCOPE(...) ffnn::profile::Scope ffnn_profile_scope(__VA_ARGS__)
+#define FFNN_PROFILE_ALLOCATION() ffnn::profile::profiler().count_allocation()
+#else
+#define FFNN_PROFILE_SCOPE(...) ((void)0)
+#define FFNN_PROFILE_ALLOCATION() ((void)0)
+#endif
+
+#endif /* !PROFILE_HPP_ */
@@ -0,0 +1,176 @@
+#ifndef PRUNEDNETWORK_HPP_
+#define PRUNEDNETWORK_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "Network.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * Inference only, magnitude pruned version of a Network<T>.
+     *
+     * Only the largest weights of each layer, in absolute value, are
+     * kept, stored row by row in compressed sparse row format: eval
+     * reads and multiplies the kept weights only, the pruned ones
+     * being zeros.
+     *
+     * Only the layers using one of the activations of
+     * Activation.hpp are supported, not custom ones.
+     */
+    template<typename T>
+    class PrunedNetwork
+    {
+    public:
+        //! Buffers used by eval, to not allocate at each call.
+        struct Scratch
+        {
+            vector<T> input;
+            vector<T> output;
+        };
+
+        PrunedNetwork() {};
+        PrunedNetwork(const Network<T> &net, double density)
+        {
+            load(net, density);
+        };
+
+        //! Prune net, keeping the density fraction of the weights of
+        //! each layer with the largest absolute values. Weights equal
+        //! to the smallest kept one are all kept.
+        //! \return false if a layer has a custom activation, or if
+        //!         density isn't in (0, 1].
+        bool load(const Network<T> &net, double density)
+        {
+            const auto &src = net.get_layers();
+            layers.clear();
+            if (!(density > 0 && density <= 1))
+                return false;
+            for (const auto &layer : src)
+                if (layer.get_activation() == ActivationId::custom)
+                    return false;
+
+            layers.resize(src.size());
+            std::vector<T> magnitudes;
+            for (unsigned int l = 0; l < src.size(); l++)
+            {
+                PrunedLayer &p = layers[l];
+                const matrix<T> &w = src[l].get_weights();
+                p.rows = w.size1();
+                p.cols = w.size2();
+                p.activation = src[l].get_activation();
+                p.biases = src[l].get_biases();
+
+                // The smallest magnitude kept.
+                const std::size_t size = w.data().size();
+                T threshold = 0;
+                if (size > 0)
+                {
+                    const std::size_t keep = std::max<std::size_t>(1, std::ceil(density * size));
+                    magnitudes.resize(size);
+                    for (std::size_t i = 0; i < size; i++)
+                        magnitudes[i] = std::abs(w.data()[i]);
+                    std::nth_element(magnitudes.begin(), magnitudes.begin() + (keep - 1),
+                                     magnitudes.end(), std::greater<T>());
+                    threshold = magnitudes[keep - 1];
+                }
+
+                p.starts.assign(1, 0);
+                p.columns.clear();
+                p.values.clear();
+                for (unsigned int i = 0; i < p.rows; i++)
+                {
+                    for (unsigned int j = 0; j < p.cols; j++)
+                        if (std::abs(w(i, j)) >= threshold && w(i, j) != T(0))
+                        {
+                            p.columns.push_back(j);
+                            p.values.push_back(w(i, j));
+                        }
+                    p.starts.push_back(p.values.size());
+                }
+            }
+            return true;
+        }
+
+        bool empty() const {return layers.empty();};
+
+        //! Fraction of the weights kept, over all the layers.
+        double density() const
+        {
+            std::size_t kept = 0, size = 0;
+            for (const auto &p : layers)
+            {
+                kept += p.values.size();
+                size += std::size_t(p.rows) * p.cols;
+            }
+            return size ? double(kept) / size : 0;
+        }
+
+        //! Number of bytes used by the weights, their positions and
+        //! the biases.
+        std::size_t storage_size() const
+        {
+            std::size_t size = 0;
+            for (const auto &p : layers)
+                size += p.values.size() * sizeof(T) + p.columns.size() * sizeof(unsigned int)
+                    + p.starts.size() * sizeof(unsigned int) + p.biases.size() * sizeof(T);
+            return size;
+        }
+
+        //! Evaluate the network, like Network::eval.
+        vector<T> eval(const vector<T> &input) const
+        {
+            Scratch s;
+            return eval(s, input);
+        }
+
+        //! Evaluate the network using the buffers of s.
+        //! \return A reference to the output, stored inside s.
+        const vector<T> &eval(Scratch &s, const vector<T> &input) const
+        {
+            const T *in = &input[0];
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                const PrunedLayer &p = layers[l];
+                if (l > 0)
+                    s.input.swap(s.output);
+                if (s.output.size() != p.rows)
+                    s.output.resize(p.rows, false);
+                T *out = &s.output[0];
+                for (unsigned int i = 0; i < p.rows; i++)
+                {
+                    T sum = 0;
+                    for (unsigned int k = p.starts[i]; k < p.starts[i + 1]; k++)
+                        sum += p.values[k] * in[p.columns[k]];
+                    out[i] = sum;
+                }
+                activate(p.activation, out, &p.biases[0], p.rows, 1);
+                in = out;
+            }
+            return s.output;
+        }
+
+    private:
+        struct PrunedLayer
+        {
+            unsigned int rows;
+            unsigned int cols;
+            ActivationId activation;
+            //! The kept weights of row i are values[k] at the columns
+            //! columns[k], for k in [starts[i], starts[i + 1]).
+            std::vector<unsigned int> starts;
+            std::vector<unsigned int> columns;
+            std::vector<T> values;
+            vector<T> biases;
+        };
+
+        std::vector<PrunedLayer> layers;
+    };
+}
+
+#endif /* !PRUNEDNETWORK_HPP_ */
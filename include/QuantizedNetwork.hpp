@@ -0,0 +1,170 @@
+#ifndef QUANTIZEDNETWORK_HPP_
+#define QUANTIZEDNETWORK_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Network.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    /**
+     * Inference only, 8 bits version of a Network<T>.
+     *
+     * The weights are stored as int8 with one scale per row (per
+     * neuron), and the input of each layer is quantized to int8
+     * with one scale per layer, found by running the network over
+     * a calibration set. The products are accumulated in int32,
+     * then the accumulator is scaled back to T, the biases and the
+     * activation being applied in T.
+     *
+     * The model is about 4 times smaller than a Network<float>.
+     * Only the layers using one of the activations of
+     * Activation.hpp are supported, not custom ones.
+     */
+    template<typename T>
+    class QuantizedNetwork
+    {
+    public:
+        //! Buffers used by eval, to not allocate at each call.
+        struct Scratch
+        {
+            std::vector<std::int8_t> input;
+            std::vector<std::int32_t> accumulators;
+            vector<T> output;
+        };
+
+        QuantizedNetwork() {};
+        QuantizedNetwork(const Network<T> &net, const matrix<T> &calibration)
+        {
+            load(net, calibration);
+        };
+
+        //! Quantize net. The scale of the input of each layer is
+        //! chosen to cover the largest value seen over the samples of
+        //! calibration, one per column.
+        //! \return false if a layer has a custom activation, or if
+        //!         there is no calibration sample.
+        bool load(const Network<T> &net, const matrix<T> &calibration)
+        {
+            const auto &src = net.get_layers();
+            layers.clear();
+            if (calibration.size2() == 0)
+                return false;
+            for (const auto &layer : src)
+                if (layer.get_activation() == ActivationId::custom)
+                    return false;
+
+            Workspace<T> ws;
+            net.forward_batch(ws, calibration);
+
+            layers.resize(src.size());
+            for (unsigned int l = 0; l < src.size(); l++)
+            {
+                QuantizedLayer &q = layers[l];
+                const matrix<T> &w = src[l].get_weights();
+                q.rows = w.size1();
+                q.cols = w.size2();
+                q.activation = src[l].get_activation();
+                q.biases = src[l].get_biases();
+
+                const matrix<T> &a = ws.batch_activations[l];
+                T range = 0;
+                for (std::size_t i = 0; i < a.data().size(); i++)
+                    range = std::max(range, T(std::abs(a.data()[i])));
+                q.input_scale = range > 0 ? range / 127 : T(1);
+
+                q.weights.resize(q.rows * q.cols);
+                q.scales.resize(q.rows);
+                for (unsigned int i = 0; i < q.rows; i++)
+                {
+                    T row_range = 0;
+                    for (unsigned int j = 0; j < q.cols; j++)
+                        row_range = std::max(row_range, T(std::abs(w(i, j))));
+                    const T scale = row_range > 0 ? row_range / 127 : T(1);
+                    for (unsigned int j = 0; j < q.cols; j++)
+                        q.weights[i * q.cols + j] = quantize(w(i, j) / scale);
+                    // Scale of the accumulator of the row.
+                    q.scales[i] = scale * q.input_scale;
+                }
+            }
+            return true;
+        }
+
+        bool empty() const {return layers.empty();};
+
+        //! Number of bytes used by the weights, biases and scales.
+        std::size_t storage_size() const
+        {
+            std::size_t size = 0;
+            for (const auto &q : layers)
+                size += q.weights.size() + (q.scales.size() + q.biases.size()) * sizeof(T);
+            return size;
+        }
+
+        //! Evaluate the network, like Network::eval.
+        vector<T> eval(const vector<T> &input) const
+        {
+            Scratch s;
+            return eval(s, input);
+        }
+
+        //! Evaluate the network using the buffers of s.
+        //! \return A reference to the output, stored inside s.
+        const vector<T> &eval(Scratch &s, const vector<T> &input) const
+        {
+            const T *in = &input[0];
+            for (unsigned int l = 0; l < layers.size(); l++)
+            {
+                const QuantizedLayer &q = layers[l];
+                s.input.resize(q.cols);
+                const T inverse_scale = T(1) / q.input_scale;
+                for (unsigned int j = 0; j < q.cols; j++)
+                    s.input[j] = quantize(in[j] * inverse_scale);
+
+                s.accumulators.resize(q.rows);
+                gemm::gemv(q.rows, q.cols, q.weights.data(), s.input.data(), s.accumulators.data());
+
+                if (s.output.size() != q.rows)
+                    s.output.resize(q.rows, false);
+                T *out = &s.output[0];
+                for (unsigned int i = 0; i < q.rows; i++)
+                    out[i] = s.accumulators[i] * q.scales[i];
+                activate(q.activation, out, &q.biases[0], q.rows, 1);
+                in = out;
+            }
+            return s.output;
+        }
+
+    private:
+        struct QuantizedLayer
+        {
+            unsigned int rows;
+            unsigned int cols;
+            ActivationId activation;
+            //! rows x cols, row major.
+            std::vector<std::int8_t> weights;
+            //! Scale of the accumulator of each row: the scale of the
+            //! row of weights times input_scale.
+            std::vector<T> scales;
+            vector<T> biases;
+            //! Scale of the input of the layer.
+            T input_scale;
+        };
+
+        //! Round v to the nearest int8, saturating.
+        static std::int8_t quantize(T v)
+        {
+            v = std::min(T(127), std::max(T(-127), v));
+            return static_cast<std::int8_t>(v < 0 ? v - T(0.5) : v + T(0.5));
+        }
+
+        std::vector<QuantizedLayer> layers;
+    };
+}
+
+#endif /* !QUANTIZEDNETWORK_HPP_ */
@@ -0,0 +1,179 @@
+#ifndef SAMPLER_HPP_
+#define SAMPLER_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace ffnn
+{
+    /**
+     * Choose the order in which the samples of a data set are
+     * used for training, one epoch at a time.
+     *
+     * The sampler works on the indices of the samples, never on
+     * the samples themselves, and uses a few indices of memory per
+     * sample. An epoch is made of size() indices, and only depends
+     * on the seed and on the epoch number: the same epoch can be
+     * drawn again, for instance when resuming a training.
+     *
+     * Once stratified, each class of sample is spread evenly over
+     * the epoch, so that any range of it has about the class
+     * proportions of the whole set.
+     */
+    class Sampler
+    {
+    public:
+        enum class Mode : unsigned char
+        {
+            //! The samples in order.
+            sequential,
+            //! A random permutation of the samples.
+            shuffle,
+            //! Samples drawn at random with replacement.
+            replacement
+        };
+
+        explicit Sampler(unsigned int count = 0, Mode mode = Mode::shuffle, unsigned int seed = 0)
+            :count(count), mode(mode), seed(seed)
+        {};
+
+        //! Spread the classes evenly over each epoch. Stratified
+        //! replacement draws each class as many times as it has
+        //! samples.
+        //! \param labels The labels of the samples 0, ..., size() - 1,
+        //!               as integers starting at 0.
+        template<class InputIt>
+        void stratify(InputIt labels)
+        {
+            std::vector<unsigned int> label(count);
+            unsigned int classes = 0;
+            for (unsigned int i = 0; i < count; i++, ++labels)
+            {
+                label[i] = *labels;
+                classes = std::max(classes, label[i] + 1);
+            }
+
+            // Counting sort of the samples by class.
+            class_start.assign(classes + 1, 0);
+            for (unsigned int i = 0; i < count; i++)
+                class_start[label[i] + 1]++;
+            std::partial_sum(class_start.begin(), class_start.end(), class_start.begin());
+            by_class.resize(count);
+            std::vector<unsigned int> next(class_start.begin(), class_start.end() - 1);
+            for (unsigned int i = 0; i < count; i++)
+                by_class[next[label[i]]++] = i;
+        }
+
+        //! Stop spreading the classes.
+        void unstratify()
+        {
+            by_class.clear();
+            class_start.clear();
+        }
+
+        bool stratified() const {return !class_start.empty();};
+
+        //! Number of indices of each epoch.
+        unsigned int size() const {return count;};
+        Mode get_mode() const {return mode;};
+
+        //! Set indices to the samples of the epoch, in training order.
+        //! Doesn't allocate if indices already has size() elements.
+        void sample(unsigned int epoch, std::vector<unsigned int> &indices)
+        {
+            indices.resize(count);
+            std::minstd_rand eng(mix(seed, epoch));
+
+            if (!stratified())
+            {
+                draw(eng, 0, count, indices.begin());
+                return;
+            }
+
+            // Draw each class, then merge them.
+            scratch.resize(count);
+            const unsigned int classes = class_start.size() - 1;
+            for (unsigned int c = 0; c < classes; c++)
+                draw(eng, class_start[c], class_start[c + 1], scratch.begin() + class_start[c]);
+            interleave(indices);
+        }
+
+    private:
+        //! Seed of the engine of an epoch: the splitmix64 finalizer of
+        //! seed and epoch, so that close seeds or epochs give unrelated
+        //! sequences. Unlike std::seed_seq, it doesn't allocate.
+        static std::uint32_t mix(unsigned int seed, unsigned int epoch)
+        {
+            std::uint64_t z = (std::uint64_t(seed) << 32 | epoch) + 0x9e3779b97f4a7c15ull;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return std::uint32_t(z ^ (z >> 31));
+        }
+
+        //! Write the samples of by_class[first, last), or of
+        //! [first, last) when not stratified, to out.
+        template<class Engine, class OutputIt>
+        void draw(Engine &eng, unsigned int first, unsigned int last, OutputIt out) const
+        {
+            const unsigned int n = last - first;
+            auto source = [&](unsigned int i) {return stratified() ? by_class[i] : i;};
+            if (mode == Mode::replacement)
+            {
+                if (n == 0)
+                    return;
+                std::uniform_int_distribution<unsigned int> pick(first, last - 1);
+                for (unsigned int i = 0; i < n; i++, ++out)
+                    *out = source(pick(eng));
+                return;
+            }
+            OutputIt begin = out;
+            for (unsigned int i = first; i < last; i++, ++out)
+                *out = source(i);
+            if (mode == Mode::shuffle)
+                std::shuffle(begin, out, eng);
+        }
+
+        //! Merge the classes of scratch into indices, the class of
+        //! each position being the one the most behind its share.
+        void interleave(std::vector<unsigned int> &indices)
+        {
+            const unsigned int classes = class_start.size() - 1;
+            next.assign(class_start.begin(), class_start.end() - 1);
+            for (unsigned int p = 0; p < count; p++)
+            {
+                // Class c is behind by (p + 1) * n_c / count - taken_c
+                // samples, compared here multiplied by count.
+                unsigned int best = 0;
+                std::int64_t best_lag = INT64_MIN;
+                for (unsigned int c = 0; c < classes; c++)
+                {
+                    const std::int64_t n_c = class_start[c + 1] - class_start[c];
+                    const std::int64_t taken = next[c] - class_start[c];
+                    const std::int64_t lag = (p + 1) * n_c - taken * count;
+                    if (taken < n_c && lag > best_lag)
+                    {
+                        best = c;
+                        best_lag = lag;
+                    }
+                }
+                indices[p] = scratch[next[best]++];
+            }
+        }
+
+        unsigned int count;
+        Mode mode;
+        unsigned int seed;
+        //! The samples sorted by class, empty when not stratified.
+        std::vector<unsigned int> by_class;
+        //! Start of each class in by_class, and its end.
+        std::vector<unsigned int> class_start;
+        //! Buffers of sample(), kept to not allocate at each epoch.
+        std::vector<unsigned int> scratch;
+        std::vector<unsigned int> next;
+    };
+}
+
+#endif /* !SAMPLER_HPP_ */
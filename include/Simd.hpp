@@ -0,0 +1,456 @@
+#ifndef SIMD_HPP_
+#define SIMD_HPP_
+
+#include <cmath>
+#include <cstddef>
+
+/**
+ * This file implement vectorized versions of the sigmoid kernels
+ * used by the Sigmoid activation policy:
+ *
+ * sigmoid(z, n)                      z = sigmoid(z)
+ * bias_sigmoid(z, bias, rows, cols)  z(i, j) = sigmoid(z(i, j) + bias(i))
+ * sigmoid_prime_mask(delta, a, n)    delta *= a * (1 - a)
+ * sqrt(x, n)                         x = sqrt(x), for x >= 0
+ *
+ * On x86 with GCC or Clang, float and double have an SSE2 path and
+ * an AVX2 path, selected at runtime from the CPU features. The
+ * exponential is a polynomial approximation accurate to a few ulp,
+ * with the input clamped so that the result stays a normal number.
+ * Other types, or other targets, use the scalar ffnn::sigmoid.
+ * sqrt has an SSE2 path only, std::sqrt not being vectorized by the
+ * compilers as long as it can set errno.
+ */
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define FFNN_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace ffnn
+{
+    // Defined in Activation.hpp.
+    template<typename T>
+    T sigmoid(const T x);
+    template<typename T>
+    T sigmoid_prime(const T a);
+
+namespace simd
+{
+    template<typename T>
+    void sigmoid(T *z, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            z[i] = ffnn::sigmoid(z[i]);
+    }
+
+    template<typename T>
+    void bias_sigmoid(T *z, const T *bias, std::size_t rows, std::size_t cols)
+    {
+        for (std::size_t i = 0; i < rows; i++)
+            for (std::size_t j = 0; j < cols; j++)
+                z[i * cols + j] = ffnn::sigmoid(z[i * cols + j] + bias[i]);
+    }
+
+    template<typename T>
+    void sigmoid_prime_mask(T *delta, const T *a, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            delta[i] *= ffnn::sigmoid_prime(a[i]);
+    }
+
+    template<typename T>
+    void sqrt(T *x, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            x[i] = std::sqrt(x[i]);
+    }
+
+#ifdef FFNN_SIMD_X86
+    namespace detail
+    {
+        //! Computed once, true if the CPU can run the AVX2 kernels.
+        inline bool has_avx2()
+        {
+            static const bool avx2 = (__builtin_cpu_init(),
+                                      __builtin_cpu_supports("avx2") != 0);
+            return avx2;
+        }
+
+        // Constants of the exponential. x is clamped, then split into
+        // x = n * ln(2) + r with |r| <= ln(2) / 2, so exp(x) = 2^n * exp(r).
+        // exp(r) is a Taylor polynomial, of degree 6 for float and 13 for
+        // double. n is rounded by adding 1.5 * 2^mantissa_bits, which also
+        // leaves n in the low bits of the result.
+        const float exp_max_f = 88.0f;
+        const float exp_min_f = -87.0f;
+        const float log2e_f = 1.44269504088896341f;
+        const float ln2_hi_f = 0.693359375f;
+        const float ln2_lo_f = -2.12194440e-4f;
+        const float round_f = 12582912.0f;
+
+        const double exp_max_d = 709.0;
+        const double exp_min_d = -708.0;
+        const double log2e_d = 1.4426950408889634074;
+        const double ln2_hi_d = 6.93145751953125e-1;
+        const double ln2_lo_d = 1.42860682030941723212e-6;
+        const double round_d = 6755399441055744.0;
+
+        //////////////
+        // SSE2, float
+
+        inline __m128 exp_ps(__m128 x)
+        {
+            x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(exp_min_f)), _mm_set1_ps(exp_max_f));
+            __m128 t = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(log2e_f)), _mm_set1_ps(round_f));
+            __m128 n = _mm_sub_ps(t, _mm_set1_ps(round_f));
+            __m128 r = _mm_sub_ps(x, _mm_mul_ps(n, _mm_set1_ps(ln2_hi_f)));
+            r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(ln2_lo_f)));
+
+            __m128 p = _mm_set1_ps(1.0f / 720);
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 120));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 24));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 6));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(0.5f));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+            p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+
+            __m128i e = _mm_sub_epi32(_mm_castps_si128(t), _mm_castps_si128(_mm_set1_ps(round_f)));
+            e = _mm_slli_epi32(_mm_add_epi32(e, _mm_set1_epi32(127)), 23);
+            return _mm_mul_ps(p, _mm_castsi128_ps(e));
+        }
+
+        inline __m128 sigmoid_ps(__m128 z)
+        {
+            __m128 one = _mm_set1_ps(1.0f);
+            return _mm_div_ps(one, _mm_add_ps(one, exp_ps(_mm_sub_ps(_mm_setzero_ps(), z))));
+        }
+
+        inline void bias_sigmoid_sse2(float *z, const float *bias, std::size_t n)
+        {
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_ps(z + i, sigmoid_ps(_mm_add_ps(_mm_loadu_ps(z + i),
+                                                           _mm_loadu_ps(bias + i))));
+            for (; i < n; i++)
+                z[i] = ffnn::sigmoid(z[i] + bias[i]);
+        }
+
+        inline void bias_sigmoid_sse2(float *z, float bias, std::size_t n)
+        {
+            __m128 b = _mm_set1_ps(bias);
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+                _mm_storeu_ps(z + i, sigmoid_ps(_mm_add_ps(_mm_loadu_ps(z + i), b)));
+            for (; i < n; i++)
+                z[i] = ffnn::sigmoid(z[i] + bias);
+        }
+
+        inline void sigmoid_prime_mask_sse2(float *delta, const float *a, std::size_t n)
+        {
+            __m128 one = _mm_set1_ps(1.0f);
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128 va = _mm_loadu_ps(a + i);
+                __m128 d = _mm_mul_ps(va, _mm_sub_ps(one, va));
+                _mm_storeu_ps(delta + i, _mm_mul_ps(_mm_loadu_ps(delta + i), d));
+            }
+            for (; i < n; i++)
+                delta[i] *= ffnn::sigmoid_prime(a[i]);
+        }
+
+        ///////////////
+        // SSE2, double
+
+        inline __m128d exp_pd(__m128d x)
+        {
+            x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(exp_min_d)), _mm_set1_pd(exp_max_d));
+            __m128d t = _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(log2e_d)), _mm_set1_pd(round_d));
+            __m128d n = _mm_sub_pd(t, _mm_set1_pd(round_d));
+            __m128d r = _mm_sub_pd(x, _mm_mul_pd(n, _mm_set1_pd(ln2_hi_d)));
+            r = _mm_sub_pd(r, _mm_mul_pd(n, _mm_set1_pd(ln2_lo_d)));
+
+            // 1/13!, 1/12!, ..., 1/2!
+            static const double c[] = {
+                1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0,
+                1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0,
+                1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5};
+            __m128d p = _mm_set1_pd(c[0]);
+            for (int k = 1; k < 12; k++)
+                p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(c[k]));
+            p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0));
+            p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0));
+
+            __m128i e = _mm_sub_epi64(_mm_castpd_si128(t), _mm_castpd_si128(_mm_set1_pd(round_d)));
+            e = _mm_slli_epi64(_mm_add_epi64(e, _mm_set1_epi64x(1023)), 52);
+            return _mm_mul_pd(p, _mm_castsi128_pd(e));
+        }
+
+        inline __m128d sigmoid_pd(__m128d z)
+        {
+            __m128d one = _mm_set1_pd(1.0);
+            return _mm_div_pd(one, _mm_add_pd(one, exp_pd(_mm_sub_pd(_mm_setzero_pd(), z))));
+        }
+
+        inline void bias_sigmoid_sse2(double *z, const double *bias, std::size_t n)
+        {
+            std::size_t i = 0;
+            for (; i + 2 <= n; i += 2)
+                _mm_storeu_pd(z + i, sigmoid_pd(_mm_add_pd(_mm_loadu_pd(z + i),
+                                                           _mm_loadu_pd(bias + i))));
+            for (; i < n; i++)
+                z[i] = ffnn::sigmoid(z[i] + bias[i]);
+        }
+
+        inline void bias_sigmoid_sse2(double *z, double bias, std::size_t n)
+        {
+            __m128d b = _mm_set1_pd(bias);
+            std::size_t i = 0;
+            for (; i + 2 <= n; i += 2)
+                _mm_storeu_pd(z + i, sigmoid_pd(_mm_add_pd(_mm_loadu_pd(z + i), b)));
+            for (; i < n; i++)
+                z[i] = ffnn::sigmoid(z[i] + bias);
+        }
+
+        inline void sigmoid_prime_mask_sse2(double *delta, const double *a, std::size_t n)
+        {
+            __m128d one = _mm_set1_pd(1.0);
+            std::size_t i = 0;
+            for (; i + 2 <= n; i += 2)
+            {
+                __m128d va = _mm_loadu_pd(a + i);
+                __m128d d = _mm_mul_pd(va, _mm_sub_pd(one, va));
+                _mm_storeu_pd(delta + i, _mm_mul_pd(_mm_loadu_pd(delta + i), d));
+            }
+            for (; i < n; i++)
+                delta[i] *= ffnn::sigmoid_prime(a[i]);
+        }
+
+        //////////////
+        // AVX2, float
+
+        __attribute__((target("avx2")))
+        inline __m256 exp_ps(__m256 x)
+        {
+            x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(exp_min_f)), _mm256_set1_ps(exp_max_f));
+            __m256 t = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(log2e_f)), _mm256_set1_ps(round_f));
+            __m256 n = _mm256_sub_ps(t, _mm256_set1_ps(round_f));
+            __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(ln2_hi_f)));
+            r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(ln2_lo_f)));
+
+            __m256 p = _mm256_set1_ps(1.0f / 720);
+            p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.0f / 120));
+            p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.0f / 24));
+            p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.0f / 6));
+            p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(0.5f));
+            p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.0f));
+            p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.0f));
+
+            __m256i e = _mm256_sub_epi32(_mm256_castps_si256(t), _mm256_castps_si256(_mm256_set1_ps(round_f)));
+            e = _mm256_slli_epi32(_mm256_add_epi32(e, _mm256_set1_epi32(127)), 23);
+            return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+        }
+
+        __attribute__((target("avx2")))
+        inline __m256 sigmoid_ps(__m256 z)
+        {
+            __m256 one = _mm256_set1_ps(1.0f);
+            return _mm256_div_ps(one, _mm256_add_ps(one, exp_ps(_mm256_sub_ps(_mm256_setzero_ps(), z))));
+        }
+
+        __attribute__((target("avx2")))
+        inline void bias_sigmoid_avx2(float *z, const float *bias, std::size_t n)
+        {
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(z + i, sigmoid_ps(_mm256_add_ps(_mm256_loadu_ps(z + i),
+                                                                 _mm256_loadu_ps(bias + i))));
+            bias_sigmoid_sse2(z + i, bias + i, n - i);
+        }
+
+        __attribute__((target("avx2")))
+        inline void bias_sigmoid_avx2(float *z, float bias, std::size_t n)
+        {
+            __m256 b = _mm256_set1_ps(bias);
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+                _mm256_storeu_ps(z + i, sigmoid_ps(_mm256_add_ps(_mm256_loadu_ps(z + i), b)));
+            bias_sigmoid_sse2(z + i, bias, n - i);
+        }
+
+        __attribute__((target("avx2")))
+        inline void sigmoid_prime_mask_avx2(float *delta, const float *a, std::size_t n)
+        {
+            __m256 one = _mm256_set1_ps(1.0f);
+            std::size_t i = 0;
+            for (; i + 8 <= n; i += 8)
+            {
+                __m256 va = _mm256_loadu_ps(a + i);
+                __m256 d = _mm256_mul_ps(va, _mm256_sub_ps(one, va));
+                _mm256_storeu_ps(delta + i, _mm256_mul_ps(_mm256_loadu_ps(delta + i), d));
+            }
+            sigmoid_prime_mask_sse2(delta + i, a + i, n - i);
+        }
+
+        ///////////////
+        // AVX2, double
+
+        __attribute__((target("avx2")))
+        inline __m256d exp_pd(__m256d x)
+        {
+            x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(exp_min_d)), _mm256_set1_pd(exp_max_d));
+            __m256d t = _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(log2e_d)), _mm256_set1_pd(round_d));
+            __m256d n = _mm256_sub_pd(t, _mm256_set1_pd(round_d));
+            __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(ln2_hi_d)));
+            r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(ln2_lo_d)));
+
+            // 1/13!, 1/12!, ..., 1/2!
+            static const double c[] = {
+                1.0 / 6227020800.0, 1.0 / 479001600.0, 1.0 / 39916800.0,
+                1.0 / 3628800.0, 1.0 / 362880.0, 1.0 / 40320.0, 1.0 / 5040.0,
+                1.0 / 720.0, 1.0 / 120.0, 1.0 / 24.0, 1.0 / 6.0, 0.5};
+            __m256d p = _mm256_set1_pd(c[0]);
+            for (int k = 1; k < 12; k++)
+                p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(c[k]));
+            p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0));
+            p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0));
+
+            __m256i e = _mm256_sub_epi64(_mm256_castpd_si256(t), _mm256_castpd_si256(_mm256_set1_pd(round_d)));
+            e = _mm256_slli_epi64(_mm256_add_epi64(e, _mm256_set1_epi64x(1023)), 52);
+            return _mm256_mul_pd(p, _mm256_castsi256_pd(e));
+        }
+
+        __attribute__((target("avx2")))
+        inline __m256d sigmoid_pd(__m256d z)
+        {
+            __m256d one = _mm256_set1_pd(1.0);
+            return _mm256_div_pd(one, _mm256_add_pd(one, exp_pd(_mm256_sub_pd(_mm256_setzero_pd(), z))));
+        }
+
+        __attribute__((target("avx2")))
+        inline void bias_sigmoid_avx2(double *z, const double *bias, std::size_t n)
+        {
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(z + i, sigmoid_pd(_mm256_add_pd(_mm256_loadu_pd(z + i),
+                                                                 _mm256_loadu_pd(bias + i))));
+            bias_sigmoid_sse2(z + i, bias + i, n - i);
+        }
+
+        __attribute__((target("avx2")))
+        inline void bias_sigmoid_avx2(double *z, double bias, std::size_t n)
+        {
+            __m256d b = _mm256_set1_pd(bias);
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(z + i, sigmoid_pd(_mm256_add_pd(_mm256_loadu_pd(z + i), b)));
+            bias_sigmoid_sse2(z + i, bias, n - i);
+        }
+
+        __attribute__((target("avx2")))
+        inline void sigmoid_prime_mask_avx2(double *delta, const double *a, std::size_t n)
+        {
+            __m256d one = _mm256_set1_pd(1.0);
+            std::size_t i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                __m256d va = _mm256_loadu_pd(a + i);
+                __m256d d = _mm256_mul_pd(va, _mm256_sub_pd(one, va));
+                _mm256_storeu_pd(delta + i, _mm256_mul_pd(_mm256_loadu_pd(delta + i), d));
+            }
+            sigmoid_prime_mask_sse2(delta + i, a + i, n - i);
+        }
+
+        //! Dispatch of the kernels for float and double.
+        template<typename T>
+        void bias_sigmoid(T *z, const T *bias, std::size_t rows, std::size_t cols)
+        {
+            const bool avx2 = has_avx2();
+            // A vector, or a batch of one: bias is added element by element.
+            if (cols == 1)
+            {
+                if (avx2)
+                    bias_sigmoid_avx2(z, bias, rows);
+                else
+                    bias_sigmoid_sse2(z, bias, rows);
+                return;
+            }
+            // A batch: the bias of the row is broadcasted.
+            for (std::size_t i = 0; i < rows; i++)
+            {
+                if (avx2)
+                    bias_sigmoid_avx2(z + i * cols, bias[i], cols);
+                else
+                    bias_sigmoid_sse2(z + i * cols, bias[i], cols);
+            }
+        }
+
+        template<typename T>
+        void sigmoid_prime_mask(T *delta, const T *a, std::size_t n)
+        {
+            if (has_avx2())
+                sigmoid_prime_mask_avx2(delta, a, n);
+            else
+                sigmoid_prime_mask_sse2(delta, a, n);
+        }
+    }
+
+    inline void sigmoid(float *z, std::size_t n)
+    {
+        if (detail::has_avx2())
+            detail::bias_sigmoid_avx2(z, 0.0f, n);
+        else
+            detail::bias_sigmoid_sse2(z, 0.0f, n);
+    }
+
+    inline void sigmoid(double *z, std::size_t n)
+    {
+        if (detail::has_avx2())
+            detail::bias_sigmoid_avx2(z, 0.0, n);
+        else
+            detail::bias_sigmoid_sse2(z, 0.0, n);
+    }
+
+    inline void bias_sigmoid(float *z, const float *bias, std::size_t rows, std::size_t cols)
+    {
+        detail::bias_sigmoid(z, bias, rows, cols);
+    }
+
+    inline void bias_sigmoid(double *z, const double *bias, std::size_t rows, std::size_t cols)
+    {
+        detail::bias_sigmoid(z, bias, rows, cols);
+    }
+
+    inline void sigmoid_prime_mask(float *delta, const float *a, std::size_t n)
+    {
+        detail::sigmoid_prime_mask(delta, a, n);
+    }
+
+    inline void sigmoid_prime_mask(double *delta, const double *a, std::size_t n)
+    {
+        detail::sigmoid_prime_mask(delta, a, n);
+    }
+
+    inline void sqrt(float *x, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm_storeu_ps(x + i, _mm_sqrt_ps(_mm_loadu_ps(x + i)));
+        for (; i < n; i++)
+            x[i] = std::sqrt(x[i]);
+    }
+
+    inline void sqrt(double *x, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(x + i, _mm_sqrt_pd(_mm_loadu_pd(x + i)));
+        for (; i < n; i++)
+            x[i] = std::sqrt(x[i]);
+    }
+#endif
+}
+}
+
+#endif /* !SIMD_HPP_ */
@@ -0,0 +1,262 @@
+#ifndef STATICNETWORK_HPP_
+#define STATICNETWORK_HPP_
+
+#include <algorithm>
+#include <array>
+#include <string>
+
+#include "Network.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    namespace detail
+    {
+        //! The first and the last of Sizes.
+        template<unsigned int... Sizes>
+        struct StaticSizes;
+
+        template<unsigned int Size>
+        struct StaticSizes<Size>
+        {
+            static const unsigned int first = Size;
+            static const unsigned int last = Size;
+        };
+
+        template<unsigned int Size, unsigned int... Rest>
+        struct StaticSizes<Size, Rest...>
+        {
+            static const unsigned int first = Size;
+            static const unsigned int last = StaticSizes<Rest...>::last;
+        };
+
+        //! Layer of In inputs and Out neurons, with inline weights.
+        template<typename T, unsigned int In, unsigned int Out>
+        struct StaticLayer
+        {
+            //! out = activation(weights in + biases).
+            void forward(const T *in, T *out) const
+            {
+                gemm::gemv(Out, In, &weights[0][0], in, out);
+                activate(activation, out, biases, Out, 1);
+            }
+
+            //! Move the weights and biases by -h times the gradient,
+            //! delta being dC_over_dz of the layer for input in.
+            void update(T h, const T *in, const T *delta)
+            {
+                for (unsigned int i = 0; i < Out; i++)
+                {
+                    const T d = h * delta[i];
+                    for (unsigned int j = 0; j < In; j++)
+                        weights[i][j] -= d * in[j];
+                    biases[i] -= d;
+                }
+            }
+
+            alignas(64) T weights[Out][In];
+            alignas(64) T biases[Out];
+            ActivationId activation;
+        };
+
+        //! The layers of sizes In, Out, Rest..., the first one
+        //! followed by the chain of the other ones. Each member
+        //! function handles its layer and calls the next one, which
+        //! the compiler inlines into a single function.
+        template<typename T, unsigned int... Sizes>
+        struct StaticChain;
+
+        template<typename T, unsigned int Last>
+        struct StaticChain<T, Last>
+        {
+            static const unsigned int layer_count = 0;
+
+            void eval(const T *in, T *out) const
+            {
+                std::copy(in, in + Last, out);
+            }
+
+            //! dC_over_da of the output layer, for the quadratic cost.
+            void train(T, const T *a, const T *target, T *delta)
+            {
+                for (unsigned int i = 0; i < Last; i++)
+                    delta[i] = a[i] - target[i];
+            }
+
+            bool load(const std::vector<Layer<T>> &layers, unsigned int l) {return l == layers.size();}
+            void store(Network<T> &) const {}
+        };
+
+        template<typename T, unsigned int In, unsigned int Out, unsigned int... Rest>
+        struct StaticChain<T, In, Out, Rest...>
+        {
+            static const unsigned int layer_count = 1 + sizeof...(Rest);
+
+            void eval(const T *in, T *out) const
+            {
+                T a[Out];
+                layer.forward(in, a);
+                next.eval(a, out);
+            }
+
+            //! Train on (in, target) and set delta to dC_over_da of
+            //! the layer before, computed with the weights as they were
+            //! before the update.
+            void train(T h, const T *in, const T *target, T *delta)
+            {
+                T a[Out], d[Out];
+                layer.forward(in, a);
+                next.train(h, a, target, d);
+                derivative_mask(layer.activation, d, a, Out, 1);
+                if (delta)
+                    gemm::gemv_trans(Out, In, &layer.weights[0][0], d, delta);
+                layer.update(h, in, d);
+            }
+
+            //! Copy layers[l], ... into the chain.
+            //! \return false if the sizes or the activations don't match.
+            bool load(const std::vector<Layer<T>> &layers, unsigned int l)
+            {
+                if (l >= layers.size())
+                    return false;
+                const Layer<T> &src = layers[l];
+                if (src.get_input_size() != In || src.get_output_size() != Out
+                    || src.get_activation() == ActivationId::custom)
+                    return false;
+                const matrix<T> &w = src.get_weights();
+                for (unsigned int i = 0; i < Out; i++)
+                {
+                    for (unsigned int j = 0; j < In; j++)
+                        layer.weights[i][j] = w(i, j);
+                    layer.biases[i] = src.get_biases()[i];
+                }
+                layer.activation = src.get_activation();
+                return next.load(layers, l + 1);
+            }
+
+            //! Append the layers of the chain to net.
+            void store(Network<T> &net) const
+            {
+                matrix<T> w(Out, In);
+                vector<T> b(Out);
+                for (unsigned int i = 0; i < Out; i++)
+                {
+                    for (unsigned int j = 0; j < In; j++)
+                        w(i, j) = layer.weights[i][j];
+                    b[i] = layer.biases[i];
+                }
+                net.connect_layer(Layer<T>(w, b, layer.activation));
+                next.store(net);
+            }
+
+            StaticLayer<T, In, Out> layer;
+            StaticChain<T, Out, Rest...> next;
+        };
+    }
+
+    /**
+     * Network of fixed topology, the sizes of the input and of each
+     * layer being template parameters: StaticNetwork<float, 84, 15, 10>
+     * is the 84 -> 15 -> 10 network.
+     *
+     * The weights are arrays inside the object, aligned on 64 bytes
+     * (when the object itself is, C++11 heap allocations only
+     * guaranteeing 16), and every size is a compile time constant:
+     * eval and train are inlined into a single function calling the
+     * gemm kernels with constant bounds, the activations living on
+     * the stack, without any allocation. Meant for small models, the
+     * whole network being in the object.
+     *
+     * A StaticNetwork is made from a Network<T> of the same topology
+     * and converts back to one, which also gives it the file formats
+     * of Network. Only the activations of Activation.hpp are
+     * supported, not custom ones.
+     */
+    template<typename T, unsigned int... Sizes>
+    class StaticNetwork
+    {
+        static_assert(sizeof...(Sizes) >= 2, "A network needs an input size and a layer");
+        typedef detail::StaticChain<T, Sizes...> chain_type;
+
+    public:
+        static const unsigned int layer_count = chain_type::layer_count;
+        static const unsigned int input_size = detail::StaticSizes<Sizes...>::first;
+        static const unsigned int output_size = detail::StaticSizes<Sizes...>::last;
+
+        //! A network with no valid weights, to be load()ed.
+        StaticNetwork() {};
+        explicit StaticNetwork(const Network<T> &net)
+        {
+            load(net);
+        };
+
+        //! Copy the layers of net.
+        //! \return false if net doesn't have this topology, or has a
+        //!         layer with a custom activation.
+        bool load(const Network<T> &net)
+        {
+            return chain.load(net.get_layers(), 0);
+        }
+
+        //! The same network as a Network<T>.
+        Network<T> to_network() const
+        {
+            Network<T> net;
+            chain.store(net);
+            return net;
+        }
+
+        //! Read a file written by Network::save_file.
+        bool load_file(const std::string &filename)
+        {
+            Network<T> net;
+            return net.load_file(filename) && load(net);
+        }
+
+        //! Write the network in the format of Network::save_file.
+        //! \return false if it couldn't be written.
+        bool save_file(const std::string &filename) const
+        {
+            return to_network().save_file(filename);
+        }
+
+        //! Evaluate the network, output having output_size elements.
+        //! input and output can't overlap.
+        void eval(const T *input, T *output) const
+        {
+            chain.eval(input, output);
+        }
+
+        std::array<T, output_size> eval(const std::array<T, input_size> &input) const
+        {
+            std::array<T, output_size> output;
+            eval(input.data(), output.data());
+            return output;
+        }
+
+        //! Same as Network::eval.
+        vector<T> eval(const vector<T> &input) const
+        {
+            vector<T> output(output_size);
+            eval(&input[0], &output[0]);
+            return output;
+        }
+
+        //! Same as Network::train, on one sample.
+        void train(T h, const T *input, const T *output)
+        {
+            chain.train(h, input, output, nullptr);
+        }
+
+        void train(T h, const vector<T> &input, const vector<T> &output)
+        {
+            train(h, &input[0], &output[0]);
+        }
+
+    private:
+        chain_type chain;
+    };
+}
+
+#endif /* !STATICNETWORK_HPP_ */
@@ -0,0 +1,115 @@
+#ifndef THREADPOOL_HPP_
+#define THREADPOOL_HPP_
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ffnn
+{
+    /**
+     * A fixed set of threads running indexed tasks.
+     *
+     * run(count, task) calls task(0), ..., task(count - 1), each
+     * exactly once, spread over the threads of the pool and the
+     * calling thread, and returns when all of them are done.
+     * Which thread runs which index isn't specified, so tasks
+     * should only write to memory owned by their index.
+     */
+    class ThreadPool
+    {
+    public:
+        //! \param size Number of threads running the tasks, the
+        //!             caller of run() included. 0 means one per core.
+        explicit ThreadPool(unsigned int size = 0)
+            :task(nullptr), next(0), count(0), pending(0), stop(false)
+        {
+            if (size == 0)
+                size = std::max(1u, std::thread::hardware_concurrency());
+            for (unsigned int i = 1; i < size; i++)
+                threads.push_back(std::thread(&ThreadPool::work, this));
+        };
+
+        ~ThreadPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_all();
+            for (auto &t : threads)
+                t.join();
+        };
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator= (const ThreadPool &) = delete;
+
+        //! Number of threads running the tasks, the caller included.
+        unsigned int size() const {return threads.size() + 1;};
+
+        //! Call task(i) for each i in [0, count) and wait for all
+        //! the calls to return. Must not be called from a task.
+        void run(unsigned int count, const std::function<void(unsigned int)> &task)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            this->task = &task;
+            this->next = 0;
+            this->count = count;
+            this->pending = count;
+            wake.notify_all();
+
+            while (next < this->count)
+                run_next(lock);
+            done.wait(lock, [this]() {return pending == 0;});
+            this->task = nullptr;
+        }
+
+    private:
+        void work()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                wake.wait(lock, [this]() {return stop || next < count;});
+                if (stop)
+                    return;
+                run_next(lock);
+            }
+        }
+
+        //! Claim the next index and run it, lock being released
+        //! while the task runs.
+        void run_next(std::unique_lock<std::mutex> &lock)
+        {
+            unsigned int i = next++;
+            const std::function<void(unsigned int)> *t = task;
+            lock.unlock();
+            (*t)(i);
+            lock.lock();
+            if (--pending == 0)
+                done.notify_all();
+        }
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        //! Signaled when there are tasks to run, or on destruction.
+        std::condition_variable wake;
+        //! Signaled when the last task of a run() returns.
+        std::condition_variable done;
+
+        // All of the following are protected by mutex.
+        const std::function<void(unsigned int)> *task;
+        //! Next index to run.
+        unsigned int next;
+        //! Number of indices of the current run().
+        unsigned int count;
+        //! Number of tasks not finished yet.
+        unsigned int pending;
+        bool stop;
+    };
+}
+
+#endif /* !THREADPOOL_HPP_ */
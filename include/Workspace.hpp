@@ -0,0 +1,148 @@
+#ifndef WORKSPACE_HPP_
+#define WORKSPACE_HPP_
+
+#include <vector>
+
+#include <boost/numeric/ublas/matrix.hpp>
+#include <boost/numeric/ublas/vector.hpp>
+
+#include "Checkpoint.hpp"
+#include "Profile.hpp"
+
+namespace ffnn
+{
+    using namespace boost::numeric::ublas;
+
+    template<typename T>
+    class Layer;
+
+    /**
+     * Buffers used by Network for the forward and backward passes.
+     *
+     * A workspace is sized once from the list of layers (and the
+     * batch size for the batched functions) and can then be reused
+     * across calls to Network::forward, eval, train and train_batch
+     * without any heap allocation, as long as neither the topology
+     * nor the batch size changes. With FFNN_PROFILE defined, each
+     * buffer allocation is counted by profile::profiler().
+     */
+    template<typename T>
+    class Workspace
+    {
+    public:
+        Workspace()
+            :batch_size(0)
+        {};
+        explicit Workspace(const std::vector<Layer<T>> &layers)
+            :batch_size(0)
+        {
+            resize(layers);
+        };
+
+        //! Size the per-sample buffers for the given layer list.
+        //! Doesn't allocate when the sizes are already right.
+        void resize(const std::vector<Layer<T>> &layers)
+        {
+            activations.resize(layers.size() + 1);
+            deltas.resize(layers.size() + 1);
+            if (!layers.empty())
+                resize_vector(activations[0], layers.front().get_input_size());
+            for (unsigned int i = 0; i < layers.size(); i++)
+            {
+                resize_vector(activations[i + 1], layers[i].get_output_size());
+                resize_vector(deltas[i + 1], layers[i].get_output_size());
+            }
+        }
+
+        //! Size the batched buffers for the given layer list and
+        //! batch size. Doesn't allocate when the sizes are already right.
+        //! \param dense_input false to leave batch_activations[0] as
+        //!                    is, for sparse inputs which aren't copied.
+        void resize(const std::vector<Layer<T>> &layers, unsigned int batch_size,
+                    bool dense_input = true)
+        {
+            this->batch_size = batch_size;
+            batch_activations.resize(layers.size() + 1);
+            batch_deltas.resize(layers.size() + 1);
+            weight_gradients.resize(layers.size());
+            bias_gradients.resize(layers.size());
+            if (!layers.empty() && dense_input)
+                resize_matrix(batch_activations[0], layers.front().get_input_size(), batch_size);
+            for (unsigned int i = 0; i < layers.size(); i++)
+            {
+                const Layer<T> &l = layers[i];
+                resize_matrix(batch_activations[i + 1], l.get_output_size(), batch_size);
+                resize_matrix(batch_deltas[i + 1], l.get_output_size(), batch_size);
+                resize_matrix(weight_gradients[i], l.get_output_size(), l.get_input_size());
+                resize_vector(bias_gradients[i], l.get_output_size());
+            }
+        }
+
+        //! Size checkpoint_buffer for plan and batch_size samples,
+        //! and the gradients for the layer list, leaving the other
+        //! batched buffers as they are. Doesn't allocate when the
+        //! sizes are already right, or the buffer larger.
+        void resize(const std::vector<Layer<T>> &layers, unsigned int batch_size,
+                    const CheckpointPlan &plan)
+        {
+            this->batch_size = batch_size;
+            const std::size_t size = plan.values * batch_size;
+            if (checkpoint_buffer.size() < size)
+            {
+                checkpoint_buffer.resize(size);
+                FFNN_PROFILE_ALLOCATION();
+            }
+            weight_gradients.resize(layers.size());
+            bias_gradients.resize(layers.size());
+            for (unsigned int i = 0; i < layers.size(); i++)
+            {
+                resize_matrix(weight_gradients[i], layers[i].get_output_size(), layers[i].get_input_size());
+                resize_vector(bias_gradients[i], layers[i].get_output_size());
+            }
+        }
+
+        //! Output of each layer, the input being saw as the first layer.
+        std::vector<vector<T>> activations;
+        //! Derivative dC_over_dz of each layer, indexed like activations.
+        //! The first one is unused.
+        std::vector<vector<T>> deltas;
+
+        //! Batch size the batched buffers are sized for.
+        unsigned int batch_size;
+        //! Batched version of activations, one column per sample.
+        std::vector<matrix<T>> batch_activations;
+        //! Batched version of deltas, one column per sample.
+        std::vector<matrix<T>> batch_deltas;
+        //! Gradient of the cost over the weights of each layer.
+        std::vector<matrix<T>> weight_gradients;
+        //! Gradient of the cost over the biases of each layer.
+        std::vector<vector<T>> bias_gradients;
+        //! Gradients of a few rows of a layer, applied by an
+        //! Optimizer in Network::train_batch, sized on first use.
+        std::vector<T> gradient_tile;
+        //! Activations and deltas of Network::compute_gradients with
+        //! a CheckpointPlan, laid out as the plan says.
+        std::vector<T> checkpoint_buffer;
+
+    private:
+        static void resize_vector(vector<T> &v, unsigned int size)
+        {
+            if (v.size() != size)
+            {
+                v.resize(size, false);
+                FFNN_PROFILE_ALLOCATION();
+            }
+        }
+
+        static void resize_matrix(matrix<T> &m, unsigned int size1, unsigned int size2)
+        {
+            if (m.size1() != size1 || m.size2() != size2)
+            {
+                m.resize(size1, size2, false);
+                FFNN_PROFILE_ALLOCATION();
+            }
+        }
+    };
+}
+
+#endif /* !WORKSPACE_HPP_ */
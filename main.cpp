@@ -6,7 +6,7 @@
 using namespace ffnn;
 
 template<typename T>
-int argmax(vector<T> v)
+int argmax(const vector<T> &v)
 {
     int idx = 0;
     for (int i = 1; i < v.size(); i++)